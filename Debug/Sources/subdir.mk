@@ -4,51 +4,75 @@
 
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
+../Sources/Bench.c \
+../Sources/Capture.c \
+../Sources/Command.c \
+../Sources/Crc.c \
 ../Sources/DAC.c \
 ../Sources/Debounce.c \
 ../Sources/Display.c \
 ../Sources/FIFO.c \
+../Sources/Format.c \
+../Sources/Frequency.c \
 ../Sources/Interface.c \
+../Sources/Kernel.c \
 ../Sources/Math.c \
 ../Sources/MyPacket.c \
 ../Sources/MyRTC.c \
 ../Sources/PIT.c \
+../Sources/PLL.c \
 ../Sources/Protocol.c \
-../Sources/SampleQueue.c \
+../Sources/Schedule.c \
 ../Sources/Tariff.c \
 ../Sources/UART.c \
 ../Sources/main.c \
 ../Sources/meter.c 
 
 OBJS += \
+./Sources/Bench.o \
+./Sources/Capture.o \
+./Sources/Command.o \
+./Sources/Crc.o \
 ./Sources/DAC.o \
 ./Sources/Debounce.o \
 ./Sources/Display.o \
 ./Sources/FIFO.o \
+./Sources/Format.o \
+./Sources/Frequency.o \
 ./Sources/Interface.o \
+./Sources/Kernel.o \
 ./Sources/Math.o \
 ./Sources/MyPacket.o \
 ./Sources/MyRTC.o \
 ./Sources/PIT.o \
+./Sources/PLL.o \
 ./Sources/Protocol.o \
-./Sources/SampleQueue.o \
+./Sources/Schedule.o \
 ./Sources/Tariff.o \
 ./Sources/UART.o \
 ./Sources/main.o \
 ./Sources/meter.o 
 
 C_DEPS += \
+./Sources/Bench.d \
+./Sources/Capture.d \
+./Sources/Command.d \
+./Sources/Crc.d \
 ./Sources/DAC.d \
 ./Sources/Debounce.d \
 ./Sources/Display.d \
 ./Sources/FIFO.d \
+./Sources/Format.d \
+./Sources/Frequency.d \
 ./Sources/Interface.d \
+./Sources/Kernel.d \
 ./Sources/Math.d \
 ./Sources/MyPacket.d \
 ./Sources/MyRTC.d \
 ./Sources/PIT.d \
+./Sources/PLL.d \
 ./Sources/Protocol.d \
-./Sources/SampleQueue.d \
+./Sources/Schedule.d \
 ./Sources/Tariff.d \
 ./Sources/UART.d \
 ./Sources/main.d \
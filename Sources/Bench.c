@@ -0,0 +1,155 @@
+/*! @file
+ *
+ *  @brief Routines for measuring execution time with the DWT cycle counter.
+ *
+ *  This contains the functions for timing sections of code on the TWR-K70F120M.
+ *  Every measured section has an entry in a table which can be read back over the protocol.
+ *
+ *  @author Zhengjie Huang
+ *  @date 2017-10-17
+ */
+
+#include "Bench.h"
+#include "Cpu.h"
+#include "Command.h"
+#include "MyPacket.h"
+
+#define DEMCR_TRCENA_MASK       0x01000000u
+#define DWT_CTRL_CYCCNTENA_MASK 0x00000001u
+
+#define CMD_BENCH 0x1E
+
+static TBench BenchTable[BENCH_NB];
+
+/*! @brief Gets a statistic of a benchmark entry.
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
+ */
+static bool HandleBench(const TCommandPacket* const packet)
+{
+  if (packet->parameter1 >= BENCH_NB || packet->parameter2 > BENCH_COUNT)
+    return false;
+
+  uint32_t value = Bench_Get((TBenchId)packet->parameter1, (TBenchField)packet->parameter2);
+
+  // Saturate to the 24 bits available in a packet
+  if (value > 0xFFFFFF)
+    value = 0xFFFFFF;
+
+  return MyPacket_Put(CMD_BENCH, (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16));
+}
+
+/*! @brief Enables the cycle counter and clears all entries.
+ *
+ *  @return bool - TRUE if the cycle counter was successfully enabled.
+ */
+bool Bench_Init(void)
+{
+  for (uint8_t i = 0; i < BENCH_NB; i++)
+  {
+    BenchTable[i].last  = 0;
+    BenchTable[i].max   = 0;
+    BenchTable[i].total = 0;
+    BenchTable[i].count = 0;
+  }
+
+  // Enable trace so that the DWT is powered, then start the cycle counter
+  DEMCR |= DEMCR_TRCENA_MASK;
+  DWT_CYCCNT = 0;
+  DWT_CTRL |= DWT_CTRL_CYCCNTENA_MASK;
+
+  (void)Command_Register(CMD_BENCH, HandleBench);
+
+  return (DWT_CTRL & DWT_CTRL_CYCCNTENA_MASK) != 0;
+}
+
+/*! @brief Gets the current value of the cycle counter.
+ *
+ *  @return uint32_t cycle count, to be passed to Bench_Stop.
+ */
+uint32_t Bench_Start(void)
+{
+  return DWT_CYCCNT;
+}
+
+/*! @brief Adds a measurement to an entry.
+ *
+ *  @param bench A pointer to the entry.
+ *  @param cycles The measurement.
+ */
+static void Accumulate(TBench* const bench, const uint32_t cycles)
+{
+  bench->last = cycles;
+  if (cycles > bench->max)
+    bench->max = cycles;
+  bench->total += cycles;
+  bench->count ++;
+}
+
+/*! @brief Records the cycles elapsed since Bench_Start in an entry kept by the caller.
+ *
+ *  @param bench A pointer to the entry.
+ *  @param start Value returned by Bench_Start.
+ */
+void Bench_Record(TBench* const bench, const uint32_t start)
+{
+  // Unsigned subtraction handles the counter wrapping around
+  Accumulate(bench, DWT_CYCCNT - start);
+}
+
+/*! @brief Records the cycles elapsed since Bench_Start.
+ *
+ *  @param id The section of code that has been timed.
+ *  @param start Value returned by Bench_Start.
+ */
+void Bench_Stop(const TBenchId id, const uint32_t start)
+{
+  Bench_Record(&BenchTable[id], start);
+}
+
+/*! @brief Records a number of cycles measured some other way.
+ *
+ *  @param id The entry.
+ *  @param cycles Number of cycles.
+ */
+void Bench_Add(const TBenchId id, const uint32_t cycles)
+{
+  Accumulate(&BenchTable[id], cycles);
+}
+
+/*! @brief Gets a statistic of an entry kept by the caller.
+ *
+ *  @param bench A pointer to the entry.
+ *  @param field Which statistic to get.
+ *  @return uint32_t value of the statistic.
+ */
+uint32_t Bench_Read(const TBench* const bench, const TBenchField field)
+{
+  switch (field)
+  {
+    case BENCH_LAST:
+      return bench->last;
+    case BENCH_MAX:
+      return bench->max;
+    case BENCH_AVERAGE:
+      if (bench->count == 0)
+        return 0;
+      return (uint32_t)(bench->total / bench->count);
+    case BENCH_COUNT:
+      return bench->count;
+    default:
+      return 0;
+  }
+}
+
+/*! @brief Gets a statistic of a benchmark entry.
+ *
+ *  @param id The section of code.
+ *  @param field Which statistic to get.
+ *  @return uint32_t value of the statistic.
+ */
+uint32_t Bench_Get(const TBenchId id, const TBenchField field)
+{
+  return Bench_Read(&BenchTable[id], field);
+}
@@ -0,0 +1,103 @@
+/*! @file
+ *
+ *  @brief Routines for measuring execution time with the DWT cycle counter.
+ *
+ *  This contains the functions for timing sections of code on the TWR-K70F120M.
+ *  Every measured section has an entry in a table which can be read back over the protocol.
+ *
+ *  @author Zhengjie Huang
+ *  @date 2017-10-17
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+// new types
+#include "types.h"
+
+/*! @brief Sections of code that are timed
+ *
+ */
+typedef enum
+{
+  BENCH_METER_BLOCK,     /*!< Processing of one block of samples by the meter thread */
+  BENCH_METER_KERNEL,    /*!< Accumulation of squares and products of one block */
+  BENCH_PIT_ISR,         /*!< Sampling and DAC output in the PIT interrupt */
+  BENCH_METER_SQRT,      /*!< Square root of one channel's mean square */
+  BENCH_METER_CYCLE,     /*!< Power, energy, power factor and cost of one block */
+  BENCH_PIT_LATENCY,     /*!< Delay from the PIT timing out to its interrupt starting */
+  BENCH_NB
+} TBenchId;
+
+/*! @brief Statistics to be read back from a benchmark entry
+ *
+ */
+typedef enum
+{
+  BENCH_LAST,
+  BENCH_MAX,
+  BENCH_AVERAGE,
+  BENCH_COUNT
+} TBenchField;
+
+/*!
+ * @struct TBench
+ */
+typedef struct
+{
+  uint32_t last;         /*!< Cycles taken by the latest run */
+  uint32_t max;          /*!< Worst case cycles */
+  uint64_t total;        /*!< Cycles accumulated over all runs */
+  uint32_t count;        /*!< Number of runs */
+} TBench;
+
+/*! @brief Enables the cycle counter and clears all entries.
+ *
+ *  @return bool - TRUE if the cycle counter was successfully enabled.
+ */
+bool Bench_Init(void);
+
+/*! @brief Gets the current value of the cycle counter.
+ *
+ *  @return uint32_t cycle count, to be passed to Bench_Stop.
+ */
+uint32_t Bench_Start(void);
+
+/*! @brief Records the cycles elapsed since Bench_Start.
+ *
+ *  @param id The section of code that has been timed.
+ *  @param start Value returned by Bench_Start.
+ */
+void Bench_Stop(const TBenchId id, const uint32_t start);
+
+/*! @brief Records a number of cycles measured some other way.
+ *
+ *  @param id The entry.
+ *  @param cycles Number of cycles.
+ */
+void Bench_Add(const TBenchId id, const uint32_t cycles);
+
+/*! @brief Records the cycles elapsed since Bench_Start in an entry kept by the caller.
+ *
+ *  @param bench A pointer to the entry.
+ *  @param start Value returned by Bench_Start.
+ */
+void Bench_Record(TBench* const bench, const uint32_t start);
+
+/*! @brief Gets a statistic of an entry kept by the caller.
+ *
+ *  @param bench A pointer to the entry.
+ *  @param field Which statistic to get.
+ *  @return uint32_t value of the statistic.
+ */
+uint32_t Bench_Read(const TBench* const bench, const TBenchField field);
+
+/*! @brief Gets a statistic of a benchmark entry.
+ *
+ *  @param id The section of code.
+ *  @param field Which statistic to get.
+ *  @return uint32_t value of the statistic.
+ */
+uint32_t Bench_Get(const TBenchId id, const TBenchField field);
+
+#endif
@@ -0,0 +1,204 @@
+/*! @file
+ *
+ *  @brief Raw waveform capture.
+ *
+ *  This contains the functions for recording consecutive cycles of raw voltage and current
+ *  samples from the meter thread and reading them back in chunks over the serial port.
+ *
+ *  @author Zhengjie Huang
+ *  @date 2017-10-17
+ */
+
+#include <stddef.h>
+#include "Capture.h"
+#include "OS.h"
+#include "Command.h"
+#include "MyPacket.h"
+
+#define CMD_CAPTURE_ARM    0x29
+#define CMD_CAPTURE_STATUS 0x2A
+#define CMD_CAPTURE_READ   0x2B
+
+/*! @brief Voltage/current pairs in the order they were sampled
+ *
+ */
+static int16_t Buffer[CAPTURE_NB_PAIRS][2] __attribute__ ((aligned(0x04)));
+
+static volatile TCaptureState State = CAPTURE_IDLE;
+static uint16_t CyclesWanted;          /*!< Cycles to record */
+static uint16_t CyclesRecorded;        /*!< Cycles recorded so far */
+static uint8_t SamplesPerCycle;        /*!< Samples in a cycle, set at initialization */
+static uint32_t NextCycle;             /*!< Number of the cycle expected next */
+
+/*! @brief Arms a capture of the number of cycles in parameters 1 and 2.
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
+ */
+static bool HandleCaptureArm(const TCommandPacket* const packet)
+{
+  uint16union_t nbCycles;
+  nbCycles.s.Lo = packet->parameter1;
+  nbCycles.s.Hi = packet->parameter2;
+
+  if (!Capture_Arm(nbCycles.l))
+    return false;
+
+  return MyPacket_Put(CMD_CAPTURE_ARM, nbCycles.s.Lo, nbCycles.s.Hi, SamplesPerCycle);
+}
+
+/*! @brief Gets the state of the capture and the number of cycles recorded.
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
+ */
+static bool HandleCaptureStatus(const TCommandPacket* const packet)
+{
+  uint16union_t nbCycles;
+  TCaptureState state = Capture_GetState(&nbCycles.l);
+
+  return MyPacket_Put(CMD_CAPTURE_STATUS, (uint8_t)state, nbCycles.s.Lo, nbCycles.s.Hi);
+}
+
+/*! @brief Sends chunks of a finished capture.
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
+ */
+static bool HandleCaptureRead(const TCommandPacket* const packet)
+{
+  uint16union_t index;
+  uint16_t nbChunks = Capture_GetNbChunks();
+  uint16_t last;
+
+  index.s.Lo = packet->parameter1;
+  index.s.Hi = packet->parameter2;
+
+  if (index.l >= nbChunks)
+    return false;
+
+  // Parameter 3 is the number of chunks to send, 0 for all the rest
+  last = nbChunks;
+  if (packet->parameter3 != 0 && index.l + packet->parameter3 < nbChunks)
+    last = index.l + packet->parameter3;
+
+  // Captures are only armed by this thread, so the buffer does not change while it is sent
+  for (; index.l < last; index.l++)
+  {
+    const uint8_t head[2] = {index.s.Lo, index.s.Hi};
+
+    // Each chunk starts with its index so the client can ask again for any it lost
+    if (!MyPacket_PutFrameHead(CMD_CAPTURE_READ, head, sizeof(head), Capture_GetChunk(index.l), CAPTURE_CHUNK_SIZE))
+      return false;
+  }
+  return true;
+}
+
+
+/*! @brief Initializes the capture before first use.
+ *
+ *  @param samplesPerCycle Number of samples in a cycle.
+ *  @return bool - TRUE if the capture commands were registered.
+ */
+bool Capture_Init(const uint8_t samplesPerCycle)
+{
+  SamplesPerCycle = samplesPerCycle;
+  State = CAPTURE_IDLE;
+
+  return Command_Register(CMD_CAPTURE_ARM, HandleCaptureArm)
+      && Command_Register(CMD_CAPTURE_STATUS, HandleCaptureStatus)
+      && Command_Register(CMD_CAPTURE_READ, HandleCaptureRead);
+}
+
+/*! @brief Starts recording from the next cycle, discarding any previous capture.
+ *
+ *  @param nbCycles Number of consecutive cycles to record.
+ *  @return bool - TRUE if the cycles fit in the buffer.
+ */
+bool Capture_Arm(const uint16_t nbCycles)
+{
+  if (nbCycles == 0 || (uint32_t)nbCycles * SamplesPerCycle > CAPTURE_NB_PAIRS)
+    return false;
+
+  // The meter thread has a higher priority than any caller
+  OS_DisableInterrupts();
+  CyclesWanted    = nbCycles;
+  CyclesRecorded  = 0;
+  State           = CAPTURE_ARMED;
+  OS_EnableInterrupts();
+  return true;
+}
+
+/*! @brief Records one cycle if a capture is armed.
+ *
+ *  @param cycle Number of the cycle, used to detect cycles the meter has skipped.
+ *  @param voltage The cycle's voltage samples.
+ *  @param current The cycle's current samples.
+ *  @note Must only be called from the meter thread.
+ */
+void Capture_Cycle(const uint32_t cycle, const int16_t* const voltage, const int16_t* const current)
+{
+  if (State != CAPTURE_ARMED)
+    return;
+
+  // The cycles have to be consecutive, start again after a skipped one
+  if (CyclesRecorded != 0 && cycle != NextCycle)
+    CyclesRecorded = 0;
+  NextCycle = cycle + 1;
+
+  int16_t (* const pair)[2] = &Buffer[(uint32_t)CyclesRecorded * SamplesPerCycle];
+
+  for (uint8_t i = 0; i < SamplesPerCycle; i++)
+  {
+    pair[i][0] = voltage[i];
+    pair[i][1] = current[i];
+  }
+
+  if (++CyclesRecorded == CyclesWanted)
+    State = CAPTURE_DONE;
+}
+
+/*! @brief Gets the state of the capture.
+ *
+ *  @param nbCycles A pointer to a memory location to place the number of cycles recorded so far.
+ *  @return TCaptureState state.
+ */
+TCaptureState Capture_GetState(uint16_t* const nbCycles)
+{
+  TCaptureState state;
+
+  OS_DisableInterrupts();
+  state = State;
+  *nbCycles = CyclesRecorded;
+  OS_EnableInterrupts();
+  return state;
+}
+
+/*! @brief Gets the number of chunks holding the cycles recorded.
+ *
+ *  @return uint16_t number of chunks, 0 unless the capture is done.
+ */
+uint16_t Capture_GetNbChunks(void)
+{
+  if (State != CAPTURE_DONE)
+    return 0;
+
+  uint32_t bytes = (uint32_t)CyclesRecorded * SamplesPerCycle * sizeof(Buffer[0]);
+
+  return (uint16_t)((bytes + CAPTURE_CHUNK_SIZE - 1) / CAPTURE_CHUNK_SIZE);
+}
+
+/*! @brief Gets a chunk of a finished capture.
+ *
+ *  Each chunk holds CAPTURE_CHUNK_SIZE bytes of voltage/current pairs, voltage first, little endian.
+ *  @param index Index of the chunk.
+ *  @return const uint8_t* pointer to the chunk, NULL if it is out of range or the capture is not done.
+ */
+const uint8_t* Capture_GetChunk(const uint16_t index)
+{
+  if (index >= Capture_GetNbChunks())
+    return NULL;
+
+  // The Cortex-M4 is little endian, so the samples are already in wire order
+  return (const uint8_t*)Buffer + (uint32_t)index * CAPTURE_CHUNK_SIZE;
+}
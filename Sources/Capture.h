@@ -0,0 +1,85 @@
+/*! @file
+ *
+ *  @brief Raw waveform capture.
+ *
+ *  This contains the functions for recording consecutive cycles of raw voltage and current
+ *  samples from the meter thread and reading them back in chunks over the serial port.
+ *
+ *  @author Zhengjie Huang
+ *  @date 2017-10-17
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+// new types
+#include "types.h"
+
+// Voltage/current pairs the capture buffer holds, 8 KiB
+#define CAPTURE_NB_PAIRS 2048
+
+// Bytes of samples in a chunk, a whole number of pairs
+#define CAPTURE_CHUNK_SIZE 128
+
+// Bytes in the whole buffer
+#define CAPTURE_SIZE (CAPTURE_NB_PAIRS * 4)
+
+#if CAPTURE_SIZE % CAPTURE_CHUNK_SIZE != 0
+#error "The capture buffer must hold a whole number of chunks"
+#endif
+
+/*!
+ * @enum TCaptureState
+ */
+typedef enum
+{
+  CAPTURE_IDLE,      /*!< Nothing captured */
+  CAPTURE_ARMED,     /*!< Recording the next cycles */
+  CAPTURE_DONE       /*!< All the cycles asked for are in the buffer */
+} TCaptureState;
+
+/*! @brief Initializes the capture before first use.
+ *
+ *  @param samplesPerCycle Number of samples in a cycle.
+ *  @return bool - TRUE if the capture commands were registered.
+ */
+bool Capture_Init(const uint8_t samplesPerCycle);
+
+/*! @brief Starts recording from the next cycle, discarding any previous capture.
+ *
+ *  @param nbCycles Number of consecutive cycles to record.
+ *  @return bool - TRUE if the cycles fit in the buffer.
+ */
+bool Capture_Arm(const uint16_t nbCycles);
+
+/*! @brief Records one cycle if a capture is armed.
+ *
+ *  @param cycle Number of the cycle, used to detect cycles the meter has skipped.
+ *  @param voltage The cycle's voltage samples.
+ *  @param current The cycle's current samples.
+ *  @note Must only be called from the meter thread.
+ */
+void Capture_Cycle(const uint32_t cycle, const int16_t* const voltage, const int16_t* const current);
+
+/*! @brief Gets the state of the capture.
+ *
+ *  @param nbCycles A pointer to a memory location to place the number of cycles recorded so far.
+ *  @return TCaptureState state.
+ */
+TCaptureState Capture_GetState(uint16_t* const nbCycles);
+
+/*! @brief Gets the number of chunks holding the cycles recorded.
+ *
+ *  @return uint16_t number of chunks, 0 unless the capture is done.
+ */
+uint16_t Capture_GetNbChunks(void);
+
+/*! @brief Gets a chunk of a finished capture.
+ *
+ *  Each chunk holds CAPTURE_CHUNK_SIZE bytes of voltage/current pairs, voltage first, little endian.
+ *  @param index Index of the chunk.
+ *  @return const uint8_t* pointer to the chunk, NULL if it is out of range or the capture is not done.
+ */
+const uint8_t* Capture_GetChunk(const uint16_t index);
+
+#endif
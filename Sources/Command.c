@@ -0,0 +1,96 @@
+/*! @file
+ *
+ *  @brief Registry of the commands accepted over the serial port.
+ *
+ *  This contains the functions for modules to register a handler for each of their commands
+ *  at initialization, and for the protocol thread to dispatch a received packet to it.
+ *  Every command's calls and handling time are recorded.
+ *
+ *  @author Zhengjie Huang
+ *  @date 2017-10-17
+ */
+
+#include <stddef.h>
+#include "Command.h"
+#include "Bench.h"
+#include "MyPacket.h"
+
+// Command statistics protocol
+#define CMD_COMMAND_STATS 0x2D
+
+static TCommandHandler Handlers[COMMAND_NB];
+static TBench Stats[COMMAND_NB];     /*!< Calls and handling time of each command, in cycles */
+
+/*! @brief Gets a statistic of a command.
+ *
+ *  Parameter 1 is the command and parameter 2 the statistic, as for CMD_BENCH.
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the reply was sent.
+ */
+static bool HandleCommandStats(const TCommandPacket* const packet)
+{
+  if (packet->parameter2 > BENCH_COUNT)
+    return false;
+
+  uint32_t value = Bench_Read(&Stats[packet->parameter1], (TBenchField)packet->parameter2);
+
+  // Saturate to the 24 bits available in a packet
+  if (value > 0xFFFFFF)
+    value = 0xFFFFFF;
+
+  return MyPacket_Put(CMD_COMMAND_STATS, (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16));
+}
+
+/*! @brief Clears the registry and registers the registry's own statistics command.
+ *
+ *  @return bool - TRUE if the registry was successfully initialized.
+ *  @note Must be called before any other module registers a command.
+ */
+bool Command_Init(void)
+{
+  for (uint16_t command = 0; command < COMMAND_NB; command++)
+  {
+    Handlers[command]    = NULL;
+    Stats[command].last  = 0;
+    Stats[command].max   = 0;
+    Stats[command].total = 0;
+    Stats[command].count = 0;
+  }
+
+  return Command_Register(CMD_COMMAND_STATS, HandleCommandStats);
+}
+
+/*! @brief Registers the handler of a command.
+ *
+ *  @param command The command.
+ *  @param handler The function that handles it.
+ *  @return bool - TRUE if the command had no handler yet.
+ */
+bool Command_Register(const uint8_t command, const TCommandHandler handler)
+{
+  // Two modules claiming the same command is a programming error, keep the first
+  if (Handlers[command])
+    return false;
+
+  Handlers[command] = handler;
+  return true;
+}
+
+/*! @brief Calls the handler of a packet's command, timing it.
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command has a handler and it succeeded.
+ */
+bool Command_Dispatch(const TCommandPacket* const packet)
+{
+  const TCommandHandler handler = Handlers[packet->command];
+
+  if (!handler)
+    return false;
+
+  uint32_t start = Bench_Start();
+  bool success = handler(packet);
+
+  Bench_Record(&Stats[packet->command], start);
+  return success;
+}
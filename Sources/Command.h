@@ -0,0 +1,62 @@
+/*! @file
+ *
+ *  @brief Registry of the commands accepted over the serial port.
+ *
+ *  This contains the functions for modules to register a handler for each of their commands
+ *  at initialization, and for the protocol thread to dispatch a received packet to it.
+ *  Every command's calls and handling time are recorded.
+ *
+ *  @author Zhengjie Huang
+ *  @date 2017-10-17
+ */
+
+#ifndef COMMAND_H
+#define COMMAND_H
+
+// new types
+#include "types.h"
+
+// Number of command codes, one for each value of a packet's command byte
+#define COMMAND_NB 256
+
+/*!
+ * @struct TCommandPacket
+ */
+typedef struct
+{
+  uint8_t command;       /*!< The packet's command */
+  uint8_t parameter1;    /*!< The packet's 1st parameter */
+  uint8_t parameter2;    /*!< The packet's 2nd parameter */
+  uint8_t parameter3;    /*!< The packet's 3rd parameter */
+} TCommandPacket;
+
+/*! @brief A command handler.
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
+ */
+typedef bool (*TCommandHandler)(const TCommandPacket* const packet);
+
+/*! @brief Clears the registry and registers the registry's own statistics command.
+ *
+ *  @return bool - TRUE if the registry was successfully initialized.
+ *  @note Must be called before any other module registers a command.
+ */
+bool Command_Init(void);
+
+/*! @brief Registers the handler of a command.
+ *
+ *  @param command The command.
+ *  @param handler The function that handles it.
+ *  @return bool - TRUE if the command had no handler yet.
+ */
+bool Command_Register(const uint8_t command, const TCommandHandler handler);
+
+/*! @brief Calls the handler of a packet's command, timing it.
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command has a handler and it succeeded.
+ */
+bool Command_Dispatch(const TCommandPacket* const packet);
+
+#endif
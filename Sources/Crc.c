@@ -0,0 +1,39 @@
+/*! @file
+ *
+ *  @brief Routines for calculating cyclic redundancy checks.
+ *
+ *  This contains the CRC-16/CCITT (polynomial 0x1021, initial value 0xFFFF) used to
+ *  check blocks of data stored in Flash or sent over the serial port.
+ *
+ *  @author Zhengjie Huang
+ *  @date 2017-10-17
+ */
+
+#include "Crc.h"
+
+// CRC of each 4-bit value, so a byte takes two lookups from a 32 byte table
+static const uint16_t NibbleTable[16] =
+{
+  0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+  0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+/*! @brief Adds a block of data to a CRC.
+ *
+ *  @param crc CRC of the data so far, CRC_16_INIT for a new block.
+ *  @param data A pointer to the data.
+ *  @param length Number of bytes of data.
+ *  @return uint16_t CRC including the new data.
+ */
+uint16_t Crc_16(uint16_t crc, const void* const data, const uint16_t length)
+{
+  const uint8_t* bytes = (const uint8_t*)data;
+
+  for (uint16_t i = 0; i < length; i++)
+  {
+    crc = (uint16_t)(crc << 4) ^ NibbleTable[(crc >> 12) ^ (bytes[i] >> 4)];
+    crc = (uint16_t)(crc << 4) ^ NibbleTable[(crc >> 12) ^ (bytes[i] & 0x0F)];
+  }
+
+  return crc;
+}
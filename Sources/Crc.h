@@ -0,0 +1,30 @@
+/*! @file
+ *
+ *  @brief Routines for calculating cyclic redundancy checks.
+ *
+ *  This contains the CRC-16/CCITT (polynomial 0x1021, initial value 0xFFFF) used to
+ *  check blocks of data stored in Flash or sent over the serial port.
+ *
+ *  @author Zhengjie Huang
+ *  @date 2017-10-17
+ */
+
+#ifndef CRC_H
+#define CRC_H
+
+// new types
+#include "types.h"
+
+// Value to start a new CRC with
+#define CRC_16_INIT 0xFFFF
+
+/*! @brief Adds a block of data to a CRC.
+ *
+ *  @param crc CRC of the data so far, CRC_16_INIT for a new block.
+ *  @param data A pointer to the data.
+ *  @param length Number of bytes of data.
+ *  @return uint16_t CRC including the new data.
+ */
+uint16_t Crc_16(uint16_t crc, const void* const data, const uint16_t length);
+
+#endif
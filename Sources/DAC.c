@@ -2,13 +2,33 @@
 #include "OS.h"
 #include "Cpu.h"
 #include "analog.h"
+#include "Command.h"
 
 #define THREAD_STACK_SIZE 300
 
+#define CMD_VOLTAGE_AMP 0x1B
+#define CMD_CURRENT_AMP 0x1C
+#define CMD_PHASE       0x1D
+#define CMD_FREQUENCY   0x2F
+#define CMD_PHASE_FINE  0x30
+
+// Entries in one period of the sine table
+#define TABLE_SIZE  128
+#define TABLE_SHIFT 7
+
+#if (1 << TABLE_SHIFT) != TABLE_SIZE
+#error "TABLE_SHIFT does not match TABLE_SIZE"
+#endif
+
+// Frequencies the generator can be tuned to, in mHz
+#define FREQUENCY_MIN     45000
+#define FREQUENCY_MAX     65000
+#define FREQUENCY_DEFAULT 50000
+
 OS_THREAD_STACK(OutputThreadStack, THREAD_STACK_SIZE); /*!< The stack for the Output thread. */
 
-static int16_t VoltageSineWave[64];
-static int16_t CurrentSineWave[64];
+static int16_t VoltageSineWave[TABLE_SIZE];
+static int16_t CurrentSineWave[TABLE_SIZE];
 
 // Base: 10/32768
 // Minimum Voltage and Current
@@ -16,32 +36,37 @@ static int16_t const MinVoltage = 9266;    // represents 282.8V which is actuall
 static int16_t const MaxVoltage = 11583;   // 3.53  V
 static int16_t const MinCurrent = 0;       // 0     A
 static int16_t const MaxCurrent = 23170;   // 7.072 A
-static uint8_t const MinPhase   = 48;       // -90  degree
+// Phases are fractions of a turn in 0.32 format
+static uint32_t const MinPhase  = 0xC0000000;  // -90  degree
 
 // Step size
 static int16_t const VoltageStepSize = 1;   // Every step represents 0.03052 mV
 static int16_t const CurrentStepSize = 1;   // Every step represents 305.2 uA
-static uint8_t const PhaseStepSize   = 1;   // Every step represents 5.625 degree
+static uint32_t const PhaseStepSize  = 0x04000000;  // Every step represents 5.625 degree
 
 static int16_t VoltageAmp;
 static int16_t CurrentAmp;
 
-static uint8_t Phase;
+static uint32_t Phase;                  /*!< Phase of the current from the voltage, 0.32 */
+static uint32_t PhaseRate;              /*!< Voltage phase advance per bus clock tick, 0.32 turns in 32Q16 */
+static volatile uint32_t VoltagePhase;  /*!< Phase accumulator, 0.32 turns, advanced by the PIT ISR */
 
 bool DAC_TestMode = false;
 
 OS_ECB* OutputSemaphore;
 
-static uint8_t NbV = 0;
-static uint8_t NbC = 0;
-
 // 32Q16, range from 0 to 1, represents different parts of the sine wave
-const int32_t Ratio[64] = {0, 6423, 12785, 19024, 25079, 30893, 36409, 41575, 46340, 50660, 54491, 57797,
-                          60547, 62714, 64276, 65220, 65536, 65220, 64276, 62714, 60547, 57797, 54491,
-                          50660, 46340, 41575, 36409, 30893, 25079, 19024, 12785, 6423, 0, -6423, -12785,
-                          -19024, -25079, -30893, -36409, -41575, -46340, -50660, -54491, -57797, -60547,
-                          -62714, -64276, -65220, -65536, -65220, -64276, -62714, -60547, -57797, -54491,
-                          -50660, -46340, -41575, -36409, -30893, -25079, -19024, -12785, -6423};
+const int32_t Ratio[TABLE_SIZE] = {0, 3215, 6423, 9616, 12785, 15923, 19024, 22078, 25079, 28020, 30893, 33692,
+                                        36409, 39039, 41575, 44011, 46340, 48558, 50660, 52639, 54491, 56212, 57797, 59243,
+                                        60547, 61705, 62714, 63571, 64276, 64826, 65220, 65457, 65536, 65457, 65220, 64826,
+                                        64276, 63571, 62714, 61705, 60547, 59243, 57797, 56212, 54491, 52639, 50660, 48558,
+                                        46340, 44011, 41575, 39039, 36409, 33692, 30893, 28020, 25079, 22078, 19024, 15923,
+                                        12785, 9616, 6423, 3215, 0, -3215, -6423, -9616, -12785, -15923, -19024, -22078,
+                                        -25079, -28020, -30893, -33692, -36409, -39039, -41575, -44011, -46340, -48558, -50660, -52639,
+                                        -54491, -56212, -57797, -59243, -60547, -61705, -62714, -63571, -64276, -64826, -65220, -65457,
+                                        -65536, -65457, -65220, -64826, -64276, -63571, -62714, -61705, -60547, -59243, -57797, -56212,
+                                        -54491, -52639, -50660, -48558, -46340, -44011, -41575, -39039, -36409, -33692, -30893, -28020,
+                                        -25079, -22078, -19024, -15923, -12785, -9616, -6423, -3215};
 
 
 /*! @brief Updates the array for sine wave with give amplitude
@@ -52,17 +77,37 @@ const int32_t Ratio[64] = {0, 6423, 12785, 19024, 25079, 30893, 36409, 41575, 46
 void UpdateSineWave(int16_t* sineWave, int16_t amp)
 {
   uint8_t i;
-  for (i = 0; i < 64; i ++)
+  for (i = 0; i < TABLE_SIZE; i ++)
     // Base: 1/65536 * 10/32768 = 10/(2^31)
     // Convert to 10/32768: *65536
     sineWave[i] = (int16_t)((int64_t)Ratio[i] * (int64_t)amp >> 16);
 }
 
-/*! @brief Callback function that signals the output semaphore
+/*! @brief Looks up a sine table at a phase, interpolating between entries
  *
+ *  @param sineWave pointer to the first number in array
+ *  @param phase Fraction of a turn, 0.32
+ *  @return int16_t the value.
  */
-void DAC_Callback()
+static int16_t SineAt(const int16_t* const sineWave, const uint32_t phase)
 {
+  uint8_t index = (uint8_t)(phase >> (32 - TABLE_SHIFT));
+  // Next 16 bits of the phase are the position between this entry and the next
+  int32_t fraction = (int32_t)((phase >> (16 - TABLE_SHIFT)) & 0xFFFF);
+  int32_t first = sineWave[index];
+  int32_t next = sineWave[(index + 1) & (TABLE_SIZE - 1)];
+
+  return (int16_t)(first + (((next - first) * fraction) >> 16));
+}
+
+/*! @brief Callback function that advances the phase and signals the output semaphore
+ *
+ *  @param ticks Bus clock ticks since the previous call, so the test frequency does not
+ *               change when the meter retunes the sample period
+ */
+void DAC_Callback(const uint32_t ticks)
+{
+  VoltagePhase += (uint32_t)(((uint64_t)PhaseRate * ticks) >> 16);
   OS_SemaphoreSignal(OutputSemaphore);
 }
 
@@ -75,15 +120,97 @@ void OutputThread(void* pData)
   for (;;)
   {
     OS_SemaphoreWait(OutputSemaphore, 0);
+
+    uint32_t phase = VoltagePhase;
+    int16_t voltage = SineAt(VoltageSineWave, phase);
+    int16_t current = SineAt(CurrentSineWave, phase + Phase);
+
     OS_DisableInterrupts();
-    Analog_Put(1, VoltageSineWave[NbV]);
-    Analog_Put(2, CurrentSineWave[NbC]);
+    Analog_Put(1, voltage);
+    Analog_Put(2, current);
     OS_EnableInterrupts();
-    NbV = (NbV + 4) % 64;
-    NbC = (NbC + 4) % 64;
   }
 }
 
+/*! @brief Sets the voltage amplitude of the test waveform.
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
+ */
+static bool HandleVoltageAmp(const TCommandPacket* const packet)
+{
+  uint16union_t steps;
+  steps.s.Lo = packet->parameter1;
+  steps.s.Hi = packet->parameter2;
+
+  if (steps.l > 2317)
+    return false;
+
+  DAC_SetVoltageAmp(steps.l);
+  return true;
+}
+
+/*! @brief Sets the current amplitude of the test waveform.
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
+ */
+static bool HandleCurrentAmp(const TCommandPacket* const packet)
+{
+  uint16union_t steps;
+  steps.s.Lo = packet->parameter1;
+  steps.s.Hi = packet->parameter2;
+
+  if (steps.l > 23170)
+    return false;
+
+  DAC_SetCurrentAmp(steps.l);
+  return true;
+}
+
+/*! @brief Sets the phase of the test current.
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
+ */
+static bool HandlePhase(const TCommandPacket* const packet)
+{
+  if (packet->parameter1 > 32)
+    return false;
+
+  DAC_SetPhase(packet->parameter1);
+  return true;
+}
+
+/*! @brief Sets the frequency of the test waveform in mHz.
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
+ */
+static bool HandleFrequency(const TCommandPacket* const packet)
+{
+  uint16union_t frequency;
+  frequency.s.Lo = packet->parameter1;
+  frequency.s.Hi = packet->parameter2;
+
+  return DAC_SetFrequency(frequency.l);
+}
+
+/*! @brief Sets the phase of the test current from the voltage in 1/65536 of a turn.
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
+ */
+static bool HandlePhaseFine(const TCommandPacket* const packet)
+{
+  uint16union_t phase;
+  phase.s.Lo = packet->parameter1;
+  phase.s.Hi = packet->parameter2;
+
+  DAC_SetPhaseFine(phase.l);
+  return true;
+}
+
 /*! @brief Set up DAC before first use
  *
  */
@@ -96,12 +223,22 @@ bool DAC_Init()
   UpdateSineWave(VoltageSineWave, VoltageAmp);
   UpdateSineWave(CurrentSineWave, CurrentAmp);
 
+  Phase = MinPhase;
+  VoltagePhase = 0;
+  (void)DAC_SetFrequency(FREQUENCY_DEFAULT);
+
   OutputSemaphore = OS_SemaphoreCreate(0);
 
   OS_ThreadCreate(OutputThread,
                   NULL,
                   &OutputThreadStack[THREAD_STACK_SIZE - 1],
                   2);
+
+  return Command_Register(CMD_VOLTAGE_AMP, HandleVoltageAmp)
+      && Command_Register(CMD_CURRENT_AMP, HandleCurrentAmp)
+      && Command_Register(CMD_PHASE, HandlePhase)
+      && Command_Register(CMD_FREQUENCY, HandleFrequency)
+      && Command_Register(CMD_PHASE_FINE, HandlePhaseFine);
 }
 
 /*! @brief Set Voltage Amplitude for DAC
@@ -132,8 +269,33 @@ void DAC_SetCurrentAmp(uint16_t steps)
  */
 void DAC_SetPhase(uint8_t steps)
 {
-  Phase = (MinPhase + PhaseStepSize * steps) % 64;
-  NbC = (NbV + Phase) % 64;
+  // Wraps around a whole turn by itself
+  Phase = MinPhase + PhaseStepSize * steps;
+}
+
+/*! @brief Set Phase for DAC to any angle
+ *
+ *  @param phase Phase of the current from the voltage in 1/65536 of a turn
+ */
+void DAC_SetPhaseFine(uint16_t phase)
+{
+  Phase = (uint32_t)phase << 16;
+}
+
+/*! @brief Set Frequency for DAC
+ *
+ *  @param frequency Frequency in mHz, from 45000 to 65000
+ *  @return bool - TRUE if the frequency was in range
+ */
+bool DAC_SetFrequency(uint16_t frequency)
+{
+  if (frequency < FREQUENCY_MIN || frequency > FREQUENCY_MAX)
+    return false;
+
+  // Turns per bus clock tick in 0.32 format and 32Q16: f / 1000 / fbus * 2^32 * 2^16.
+  // 2^48 / 1000 is 2^45 / 125, which keeps the numerator within 64 bits
+  PhaseRate = (uint32_t)(((uint64_t)frequency << 45) / (125ULL * CPU_BUS_CLK_HZ));
+  return true;
 }
 
 /*! @brief Start DAC, basically set boolean to true
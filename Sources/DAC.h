@@ -32,6 +32,19 @@ void DAC_SetVoltageAmp(uint16_t steps);
  */
 void DAC_SetPhase(uint8_t steps);
 
+/*! @brief Set Phase for DAC to any angle
+ *
+ *  @param phase Phase of the current from the voltage in 1/65536 of a turn
+ */
+void DAC_SetPhaseFine(uint16_t phase);
+
+/*! @brief Set Frequency for DAC
+ *
+ *  @param frequency Frequency in mHz, from 45000 to 65000
+ *  @return bool - TRUE if the frequency was in range
+ */
+bool DAC_SetFrequency(uint16_t frequency);
+
 /*! @brief Set Current Amplitude for DAC
  *
  *  @param steps steps away from minimum Current amplitude
@@ -44,9 +57,10 @@ void DAC_SetCurrentAmp(uint16_t steps);
  */
 uint8_t DAC_GetMode();
 
-/*! @brief Call back function of DAC, basically signal the semaphore to generate wave
+/*! @brief Call back function of DAC, advances the phase and signals the semaphore to generate wave
  *
+ *  @param ticks Bus clock ticks since the previous call
  */
-void DAC_Callback();
+void DAC_Callback(const uint32_t ticks);
 
 #endif
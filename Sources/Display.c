@@ -1,69 +1,167 @@
 #include "Display.h"
 #include "LEDs.h"
 #include "OS.h"
-#include "UART.h"
+#include "MyPacket.h"
 #include "Tariff.h"
 #include "MyRTC.h"
 #include "meter.h"
+#include "Math.h"
+#include "Command.h"
+#include "Format.h"
 
-#include <stdio.h>
 #include <string.h>
 
-#define JOULE_PER_KWH 3600000
-OS_ECB* PrintSemaphore;
+#define THREAD_STACK_SIZE 100
 
-uint64_t Meter_Energy;
-uint64_t Meter_Cost;
-uint32_t Meter_AveragePower;
+#define CMD_CONSOLE_DROPS 0x2E
 
-/*! @brief Print the buffer to UART
+// Characters in the label in front of a number, e.g. "AP: "
+#define DISPLAY_LABEL_LENGTH 4
+
+// Lines waiting to be sent, a power of two so the indices can run freely
+#define CONSOLE_NB_LINES  8
+#define CONSOLE_LINE_SIZE 24
+
+#if (CONSOLE_NB_LINES & (CONSOLE_NB_LINES - 1)) != 0 || CONSOLE_NB_LINES > 128
+#error "CONSOLE_NB_LINES must be a power of two no larger than 128"
+#endif
+
+// Stops the compiler moving the copy of a line across an update of an index
+#define COMPILER_BARRIER() __asm__ volatile ("" ::: "memory")
+
+/*!
+ * @struct TConsoleLine
+ */
+typedef struct
+{
+  uint8_t length;                   /*!< Number of characters */
+  char text[CONSOLE_LINE_SIZE];     /*!< The line, not terminated */
+} TConsoleLine;
+
+static const TReciprocal PerKWh     = MATH_RECIPROCAL(JOULES_PER_KWH, 53);
+static const TReciprocal PerHundred = MATH_RECIPROCAL(100, 38);
+
+OS_THREAD_STACK(ConsoleThreadStack, THREAD_STACK_SIZE); /*!< The stack for the console thread. */
+
+static TConsoleLine Lines[CONSOLE_NB_LINES];
+static volatile uint8_t LinesStart;   /*!< Index of the oldest line, written by the console thread */
+static volatile uint8_t LinesEnd;     /*!< Index of the next free line, written by the producer */
+static volatile uint32_t Dropped;     /*!< Lines thrown away because the queue was full */
+static OS_ECB* LinesAvailable;        /*!< Signaled once for every line queued */
+
+/*! @brief Queues a line to be sent by the console thread.
  *
- *  @param buffer The buffer to be printed
- *  @param length length of buffer
+ *  Never waits and never masks interrupts. If the queue is full the line is dropped and counted.
+ *  @param buffer The line to be printed
+ *  @param length length of the line, cut to CONSOLE_LINE_SIZE
+ *  @note Only one thread may print at a time.
  */
 void printToUART(char* const buffer, uint8_t length)
 {
-//  OS_SemaphoreWait(PrintSemaphore, 0);
-  OS_DisableInterrupts();
-  for (uint8_t i = 0; i < length; i ++)
+  uint8_t end = LinesEnd;
+
+  if ((uint8_t)(end - LinesStart) == CONSOLE_NB_LINES)
   {
-    UART_OutChar((uint8_t)buffer[i]);
+    Dropped++;
+    return;
   }
-  OS_EnableInterrupts();
-//  OS_SemaphoreSignal(PrintSemaphore);
+
+  TConsoleLine* const line = &Lines[end & (CONSOLE_NB_LINES - 1)];
+
+  if (length > CONSOLE_LINE_SIZE)
+    length = CONSOLE_LINE_SIZE;
+  memcpy(line->text, buffer, length);
+  line->length = length;
+  COMPILER_BARRIER();
+  LinesEnd = end + 1;
+
+  (void)OS_SemaphoreSignal(LinesAvailable);
 }
 
-/*! @brief Convert 32Q16 to xxx.xxx
+/*! @brief Sends the queued lines in the background.
  *
- *  @param data data to be converted
- *  @param pointer to the integer part
- *  @param pointer to the decimal part
+ *  Shares the transmit FIFO with the packets, so it waits there rather than the threads printing.
+ *  @param pData thread data
  */
-void convert1(uint32_t const data, uint16_t* integer, uint16_t* decimal)
+static void ConsoleThread(void* pData)
 {
-  *integer = (uint16_t)(data >> 16);
-  *decimal = ((uint16_t)data) * 1000 / 65536;
+  for (;;)
+  {
+    (void)OS_SemaphoreWait(LinesAvailable, 0);
+
+    const TConsoleLine* const line = &Lines[LinesStart & (CONSOLE_NB_LINES - 1)];
+
+    (void)MyPacket_PutText(line->text, line->length);
+    COMPILER_BARRIER();
+    LinesStart++;
+  }
 }
 
+/*! @brief Gets the number of lines dropped because the console queue was full.
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the reply was sent.
+ */
+static bool HandleConsoleDrops(const TCommandPacket* const packet)
+{
+  uint32_t value = Dropped;
+
+  // Saturate to the 24 bits available in a packet
+  if (value > 0xFFFFFF)
+    value = 0xFFFFFF;
 
-/*! @brief Convert 32Q16 to xxxx.xx
+  return MyPacket_Put(CMD_CONSOLE_DROPS, (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16));
+}
+
+/*! @brief Print a labelled 32Q16 number on a line of its own
  *
- *  @param data data to be converted
- *  @param pointer to the integer part
- *  @param pointer to the decimal part
+ *  @param label The label, 4 characters
+ *  @param number The number in 32Q16 format
+ *  @param nbDecimals Number of decimals, 1 to 4
+ *  @param maxInteger Largest integer part that fits on the display
+ *  @param overflow What to print instead of a number that does not fit
  */
-void convert2(uint32_t const data, uint16_t* integer, uint16_t* decimal)
+static void PrintQ16(const char* const label, const uint32_t number, const uint8_t nbDecimals,
+                     const uint16_t maxInteger, const char* const overflow)
 {
-  *integer = (uint16_t)(data >> 16);
-  *decimal = ((uint16_t)data) * 100 / 65536;
+  char buffer[DISPLAY_LABEL_LENGTH + FORMAT_Q16_MAX_LENGTH(4) + 1];
+  uint8_t length = DISPLAY_LABEL_LENGTH;
+
+  memcpy(buffer, label, DISPLAY_LABEL_LENGTH);
+
+  if ((number >> 16) > maxInteger)
+  {
+    uint8_t overflowLength = (uint8_t)strlen(overflow);
+
+    memcpy(&buffer[length], overflow, overflowLength);
+    length += overflowLength;
+  }
+  else
+  {
+    length += Format_Q16(&buffer[length], number, nbDecimals);
+  }
+
+  buffer[length++] = '\n';
+  printToUART(buffer, length);
 }
 
 /*! @brief Initialize Display module before first use
- *         Basically create a semphore for display thread
+ *         Empties the console queue and creates the console thread
+ *
+ *  @return bool - TRUE if the Display module was successfully initialized.
  */
-void Display_Init()
+bool Display_Init()
 {
-  PrintSemaphore = OS_SemaphoreCreate(1);
+  LinesStart = 0;
+  LinesEnd = 0;
+  Dropped = 0;
+  LinesAvailable = OS_SemaphoreCreate(0);
+
+  return Command_Register(CMD_CONSOLE_DROPS, HandleConsoleDrops)
+      && (OS_ThreadCreate(ConsoleThread,
+                          NULL,
+                          &ConsoleThreadStack[THREAD_STACK_SIZE - 1],
+                          10) == OS_NO_ERROR);
 }
 
 /*! @brief Display metering time
@@ -71,20 +169,29 @@ void Display_Init()
  */
 void Display_MeteringTime()
 {
-  char buffer[21];
+  char buffer[18];
 
   uint8_t day, hour, minute, second;
   MyRTC_Get(&day, &hour, &minute, &second);
   if (day <= 99)
   {
-    snprintf(buffer, 20, "Time: %02d:%02d:%02d:%02d\n", day, hour, minute, second);
+    // "Time: dd:hh:mm:ss\n"
+    memcpy(buffer, "Time: ", 6);
+    Format_Digits(&buffer[6], day, 2);
+    buffer[8] = ':';
+    Format_Digits(&buffer[9], hour, 2);
+    buffer[11] = ':';
+    Format_Digits(&buffer[12], minute, 2);
+    buffer[14] = ':';
+    Format_Digits(&buffer[15], second, 2);
+    buffer[17] = '\n';
   }
   else
   {
-    snprintf(buffer, 20, "Time: xx:xx:xx:xx\n");
+    memcpy(buffer, "Time: xx:xx:xx:xx\n", 18);
   }
 
-  printToUART(buffer, strlen(buffer));
+  printToUART(buffer, sizeof(buffer));
 }
 
 /*! @brief Display average power
@@ -92,21 +199,10 @@ void Display_MeteringTime()
  */
 void Display_AveragePower()
 {
-  char buffer[14];
+  TMeterSnapshot snapshot;
 
-  uint16_t integer, decimal;
-  convert1(Meter_AveragePower, &integer, &decimal);
-
-  if (integer > 999)
-  {
-    snprintf(buffer, 14, "AP: xxx.xxx\n");
-  }
-  else
-  {
-    snprintf(buffer, 14, "AP: %d.%03d\n", integer, decimal);
-  }
-
-  printToUART(buffer, strlen(buffer));
+  Meter_GetSnapshot(&snapshot);
+  PrintQ16("AP: ", snapshot.averagePower, 3, 999, "xxx.xxx");
 }
 
 /*! @brief Display total energy
@@ -114,22 +210,11 @@ void Display_AveragePower()
  */
 void Display_TotalEnergy()
 {
-  char buffer[14];
-
-  uint16_t integer, decimal;
-  // Convert from 64Q32 to 32Q16
-  convert1((uint32_t)(Meter_Energy/JOULE_PER_KWH >> 16), &integer, &decimal);
-
-  if (integer > 999)
-  {
-    snprintf(buffer, 14, "TE: xxx.xxx\n");
-  }
-  else
-  {
-    snprintf(buffer, 14, "TE: %d.%03d\n", integer, decimal);
-  }
+  TMeterSnapshot snapshot;
 
-  printToUART(buffer, strlen(buffer));
+  Meter_GetSnapshot(&snapshot);
+  // Convert from Joule to kWh and from 64Q32 to 32Q16
+  PrintQ16("TE: ", Math_SatU32(Math_RecipMul(snapshot.energy, PerKWh) >> 16), 3, 999, "xxx.xxx");
 }
 
 /*! @brief Display total cost
@@ -137,23 +222,6 @@ void Display_TotalEnergy()
  */
 void Display_TotalCost()
 {
-  char buffer[14];
-
-  uint16_t integer, decimal;
-  convert2((uint32_t)((Meter_Cost/100) >> 16), &integer, &decimal);
-
-  if (integer > 9999)
-  {
-    snprintf(buffer, 14, "TC: xxxx.xx\n");
-  }
-  else
-  {
-    snprintf(buffer, 14, "TC: %d.%02d\n", integer, decimal);
-  }
-
-  printToUART(buffer, strlen(buffer));
+  // Convert from cents to dollars and from 64Q32 to 32Q16
+  PrintQ16("TC: ", Math_SatU32(Math_RecipMul(Meter_GetCost(), PerHundred) >> 16), 2, 9999, "xxxx.xx");
 }
-
-
-
-
@@ -4,9 +4,11 @@
 #include "types.h"
 
 /*! @brief Initialize Display module before first use
- *         Basically create a semphore for display thread
+ *         Empties the console queue and creates the console thread
+ *
+ *  @return bool - TRUE if the Display module was successfully initialized.
  */
-void Display_Init();
+bool Display_Init();
 
 /*! @brief Display metering time
  *
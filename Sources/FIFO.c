@@ -8,6 +8,13 @@
  *  @date 2017-07-30
  */
 #include "FIFO.h"
+#include <string.h>
+
+#define FIFO_MASK (FIFO_SIZE - 1)
+
+// Stops the compiler moving accesses to the buffer across an update of an index.
+// The Cortex-M4 itself does not reorder them as seen by another thread on the same core.
+#define COMPILER_BARRIER() __asm__ volatile ("" ::: "memory")
 
 /*! @brief Initialize the FIFO before first use.
  *
@@ -15,12 +22,11 @@
  *  @return void
  */
 void FIFO_Init(TFIFO* const FIFO){
-  //
   FIFO->Start = 0;
   FIFO->End = 0;
-  FIFO->NbBytes = 0;
-  FIFO->BufferAccess = OS_SemaphoreCreate(1);
-  FIFO->SpaceAvailbale = OS_SemaphoreCreate(FIFO_SIZE);
+  FIFO->PutWaiting = false;
+  FIFO->GetWaiting = false;
+  FIFO->SpaceAvailable = OS_SemaphoreCreate(0);
   FIFO->ItemsAvailable = OS_SemaphoreCreate(0);
   for(int i = 0; i < FIFO_SIZE; i++)
   {
@@ -28,63 +34,249 @@ void FIFO_Init(TFIFO* const FIFO){
   }
 }
 
-/*! @brief Put one character into the FIFO.
+/*! @brief Stores a byte in a FIFO that has room and wakes up a waiting consumer.
+ *
+ *  @param FIFO A pointer to the FIFO.
+ *  @param data The byte.
+ */
+static void Store(TFIFO* const FIFO, const uint8_t data)
+{
+  FIFO->Buffer[FIFO->End & FIFO_MASK] = data;
+  COMPILER_BARRIER();
+  FIFO->End++;
+
+  // Only an empty FIFO can have a consumer waiting
+  if (FIFO->GetWaiting)
+  {
+    FIFO->GetWaiting = false;
+    (void)OS_SemaphoreSignal(FIFO->ItemsAvailable);
+  }
+}
+
+/*! @brief Takes a byte from a FIFO that is not empty and wakes up a waiting producer.
+ *
+ *  @param FIFO A pointer to the FIFO.
+ *  @param dataPtr A pointer to a memory location to place the byte.
+ */
+static void Take(TFIFO* const FIFO, uint8_t* const dataPtr)
+{
+  *dataPtr = FIFO->Buffer[FIFO->Start & FIFO_MASK];
+  COMPILER_BARRIER();
+  FIFO->Start++;
+
+  // Only a full FIFO can have a producer waiting
+  if (FIFO->PutWaiting)
+  {
+    FIFO->PutWaiting = false;
+    (void)OS_SemaphoreSignal(FIFO->SpaceAvailable);
+  }
+}
+
+/*! @brief Waits until the FIFO has room for at least one byte.
+ *
+ *  @param FIFO A pointer to the FIFO.
+ *  @note Only the producer may wait for space.
+ */
+static void WaitForSpace(TFIFO* const FIFO)
+{
+  while ((uint16_t)(FIFO->End - FIFO->Start) == FIFO_SIZE)
+  {
+    // Announce the wait before checking again, so space freed in between is either seen
+    // here or makes the consumer signal
+    FIFO->PutWaiting = true;
+    if ((uint16_t)(FIFO->End - FIFO->Start) != FIFO_SIZE)
+    {
+      FIFO->PutWaiting = false;
+      break;
+    }
+    (void)OS_SemaphoreWait(FIFO->SpaceAvailable, 0);
+  }
+}
+
+/*! @brief Waits until the FIFO holds at least one byte.
+ *
+ *  @param FIFO A pointer to the FIFO.
+ *  @note Only the consumer may wait for data.
+ */
+static void WaitForData(TFIFO* const FIFO)
+{
+  while (FIFO->End == FIFO->Start)
+  {
+    // Announce the wait before checking again, so data put in between is either seen
+    // here or makes the producer signal
+    FIFO->GetWaiting = true;
+    if (FIFO->End != FIFO->Start)
+    {
+      FIFO->GetWaiting = false;
+      break;
+    }
+    (void)OS_SemaphoreWait(FIFO->ItemsAvailable, 0);
+  }
+}
+
+/*! @brief Put one character into the FIFO, waiting for space if it is full.
  *
  *  @param FIFO A pointer to a FIFO struct where data is to be stored.
  *  @param data A byte of data to store in the FIFO buffer.
  *  @return bool - TRUE if data is successfully stored in the FIFO.
- *  @note Assumes that FIFO_Init has been called.
+ *  @note Assumes that FIFO_Init has been called. Only one thread may put at a time.
  */
 bool FIFO_Put(TFIFO* const FIFO, const uint8_t data){
 
-  OS_SemaphoreWait(FIFO->SpaceAvailbale, 0);
-  OS_SemaphoreWait(FIFO->BufferAccess, 0);
+  WaitForSpace(FIFO);
+  Store(FIFO, data);
+  return true;
+}
 
-  FIFO->Buffer[FIFO->End] = data;
-  FIFO->End += 1;
+/*! @brief Put one character into the FIFO if it is not full, without waiting.
+ *
+ *  @param FIFO A pointer to a FIFO struct where data is to be stored.
+ *  @param data A byte of data to store in the FIFO buffer.
+ *  @return bool - TRUE if data is successfully stored in the FIFO.
+ *  @note Can be called from an ISR. Only one thread or ISR may put at a time.
+ */
+bool FIFO_TryPut(TFIFO* const FIFO, const uint8_t data)
+{
+  if ((uint16_t)(FIFO->End - FIFO->Start) == FIFO_SIZE)
+    return false;
 
-  //move the cursor to start
-  if (FIFO->End == FIFO_SIZE)
-  {
-    FIFO->End = 0;
-  }
-  FIFO->NbBytes += 1;
+  Store(FIFO, data);
+  return true;
+}
 
-  OS_SemaphoreSignal(FIFO->BufferAccess);
-  OS_SemaphoreSignal(FIFO->ItemsAvailable);
+/*! @brief Get one character from the FIFO, waiting for data if it is empty.
+ *
+ *  @param FIFO A pointer to a FIFO struct with data to be retrieved.
+ *  @param dataPtr A pointer to a memory location to place the retrieved byte.
+ *  @return bool - TRUE if data is successfully retrieved from the FIFO.
+ *  @note Assumes that FIFO_Init has been called. Only one thread may get at a time.
+ */
+bool FIFO_Get(TFIFO* const FIFO, uint8_t* const dataPtr){
 
+  WaitForData(FIFO);
+  Take(FIFO, dataPtr);
   return true;
 }
 
-/*! @brief Get one character from the FIFO.
+/*! @brief Get one character from the FIFO if it is not empty, without waiting.
  *
  *  @param FIFO A pointer to a FIFO struct with data to be retrieved.
  *  @param dataPtr A pointer to a memory location to place the retrieved byte.
  *  @return bool - TRUE if data is successfully retrieved from the FIFO.
- *  @note Assumes that FIFO_Init has been called.
+ *  @note Can be called from an ISR. Only one thread or ISR may get at a time.
  */
-bool FIFO_Get(TFIFO* const FIFO, uint8_t* const dataPtr){
+bool FIFO_TryGet(TFIFO* const FIFO, uint8_t* const dataPtr)
+{
+  if (FIFO->End == FIFO->Start)
+    return false;
 
-  OS_SemaphoreWait(FIFO->ItemsAvailable, 0);
-  OS_SemaphoreWait(FIFO->BufferAccess, 0);
+  Take(FIFO, dataPtr);
+  return true;
+}
 
-  *dataPtr = FIFO->Buffer[FIFO->Start];
+/*! @brief Puts a block of bytes into the FIFO, waiting for space if it is full.
+ *
+ *  Copies as many bytes as there is room for, in at most two pieces either side of the end
+ *  of the buffer, and makes them visible to the consumer all at once.
+ *  @param FIFO A pointer to a FIFO struct where data is to be stored.
+ *  @param data A pointer to the bytes to store.
+ *  @param length Number of bytes to store.
+ *  @return uint16_t number of bytes stored, at least one unless length is 0.
+ *  @note Assumes that FIFO_Init has been called. Only one thread may put at a time.
+ */
+uint16_t FIFO_PutBlock(TFIFO* const FIFO, const uint8_t* const data, const uint16_t length)
+{
+  if (length == 0)
+    return 0;
 
-  FIFO->Start += 1;
+  WaitForSpace(FIFO);
 
-  //move the cursor to start
-  if (FIFO->Start == FIFO_SIZE)
+  uint16_t end = FIFO->End;
+  uint16_t space = FIFO_SIZE - (uint16_t)(end - FIFO->Start);
+  uint16_t nbBytes = (length < space) ? length : space;
+  uint16_t toEnd = FIFO_SIZE - (end & FIFO_MASK);
+  uint16_t first = (nbBytes < toEnd) ? nbBytes : toEnd;
+
+  memcpy(&FIFO->Buffer[end & FIFO_MASK], data, first);
+  memcpy(FIFO->Buffer, &data[first], nbBytes - first);
+  COMPILER_BARRIER();
+  FIFO->End = end + nbBytes;
+
+  if (FIFO->GetWaiting)
   {
-    FIFO->Start = 0;
+    FIFO->GetWaiting = false;
+    (void)OS_SemaphoreSignal(FIFO->ItemsAvailable);
   }
+  return nbBytes;
+}
+
+/*! @brief Gets a block of bytes from the FIFO, waiting for data if it is empty.
+ *
+ *  Copies as many bytes as the FIFO holds, up to length, in at most two pieces either side
+ *  of the end of the buffer, and frees their space all at once.
+ *  @param FIFO A pointer to a FIFO struct with data to be retrieved.
+ *  @param data A pointer to a memory location to place the retrieved bytes.
+ *  @param length Largest number of bytes to retrieve.
+ *  @return uint16_t number of bytes retrieved, at least one unless length is 0.
+ *  @note Assumes that FIFO_Init has been called. Only one thread may get at a time.
+ */
+uint16_t FIFO_GetBlock(TFIFO* const FIFO, uint8_t* const data, const uint16_t length)
+{
+  if (length == 0)
+    return 0;
 
-  FIFO->NbBytes -= 1;
+  WaitForData(FIFO);
 
-  OS_SemaphoreSignal(FIFO->BufferAccess);
-  OS_SemaphoreSignal(FIFO->SpaceAvailbale);
+  uint16_t start = FIFO->Start;
+  uint16_t count = FIFO->End - start;
+  uint16_t nbBytes = (length < count) ? length : count;
+  uint16_t toEnd = FIFO_SIZE - (start & FIFO_MASK);
+  uint16_t first = (nbBytes < toEnd) ? nbBytes : toEnd;
 
-  return true;
+  memcpy(data, &FIFO->Buffer[start & FIFO_MASK], first);
+  memcpy(&data[first], FIFO->Buffer, nbBytes - first);
+  COMPILER_BARRIER();
+  FIFO->Start = start + nbBytes;
+
+  if (FIFO->PutWaiting)
+  {
+    FIFO->PutWaiting = false;
+    (void)OS_SemaphoreSignal(FIFO->SpaceAvailable);
+  }
+  return nbBytes;
 }
 
+/*! @brief Gets the oldest bytes in the FIFO that are next to each other in the buffer, without removing them.
+ *
+ *  @param FIFO A pointer to a FIFO struct with data to be retrieved.
+ *  @param data A pointer to a memory location to place a pointer to the oldest byte.
+ *  @return uint16_t number of bytes from there up to the newest byte or the end of the buffer.
+ *  @note The bytes stay valid until FIFO_Discard removes them. Can be called from an ISR.
+ */
+uint16_t FIFO_Peek(TFIFO* const FIFO, const uint8_t** const data)
+{
+  uint16_t start = FIFO->Start;
+  uint16_t nbBytes = FIFO->End - start;
+  uint16_t toEnd = FIFO_SIZE - (start & FIFO_MASK);
+
+  *data = &FIFO->Buffer[start & FIFO_MASK];
+  return (nbBytes < toEnd) ? nbBytes : toEnd;
+}
 
+/*! @brief Removes the oldest bytes from the FIFO, after they have been read through FIFO_Peek.
+ *
+ *  @param FIFO A pointer to a FIFO struct with data to be retrieved.
+ *  @param nbBytes Number of bytes to remove, no more than FIFO_Peek returned.
+ *  @note Can be called from an ISR.
+ */
+void FIFO_Discard(TFIFO* const FIFO, const uint16_t nbBytes)
+{
+  COMPILER_BARRIER();
+  FIFO->Start += nbBytes;
 
+  if (nbBytes && FIFO->PutWaiting)
+  {
+    FIFO->PutWaiting = false;
+    (void)OS_SemaphoreSignal(FIFO->SpaceAvailable);
+  }
+}
@@ -14,21 +14,28 @@
 // new types
 #include "types.h"
 #include "OS.h"
-// Number of bytes in a FIFO
+// Number of bytes in a FIFO, a power of two so the free running indices wrap with the buffer
 #define FIFO_SIZE 256
 
+#if (FIFO_SIZE & (FIFO_SIZE - 1)) != 0 || FIFO_SIZE > 32768
+#error "FIFO_SIZE must be a power of two no larger than 32768"
+#endif
+
 /*!
  * @struct TFIFO
+ * @brief A single producer, single consumer ring. The producer only writes End and the
+ *        consumer only writes Start, so neither needs a lock; a semaphore is only used when
+ *        one side has to wait for the other.
  */
 typedef struct
 {
-  uint16_t Start;		/*!< The index of the position of the oldest data in the FIFO */
-  uint16_t End; 		/*!< The index of the next available empty position in the FIFO */
-  OS_ECB* BufferAccess;         /*!< The semaphore for mutex */
-  OS_ECB* SpaceAvailbale;
-  OS_ECB* ItemsAvailable;
-  uint16_t volatile NbBytes;	/*!< The number of bytes currently stored in the FIFO */
-  uint8_t Buffer[FIFO_SIZE];	/*!< The actual array of bytes to store the data */
+  uint16_t volatile Start;      /*!< Free running index of the oldest data, written by the consumer only */
+  uint16_t volatile End;        /*!< Free running index of the next empty position, written by the producer only */
+  bool volatile PutWaiting;     /*!< The producer is waiting for space */
+  bool volatile GetWaiting;     /*!< The consumer is waiting for data */
+  OS_ECB* SpaceAvailable;       /*!< Signaled when a full FIFO gets space while the producer waits */
+  OS_ECB* ItemsAvailable;       /*!< Signaled when an empty FIFO gets data while the consumer waits */
+  uint8_t Buffer[FIFO_SIZE];    /*!< The actual array of bytes to store the data */
 } TFIFO;
 
 /*! @brief Initialize the FIFO before first use.
@@ -38,22 +45,81 @@ typedef struct
  */
 void FIFO_Init(TFIFO* const FIFO);
 
-/*! @brief Put one character into the FIFO.
+/*! @brief Put one character into the FIFO, waiting for space if it is full.
  *
  *  @param FIFO A pointer to a FIFO struct where data is to be stored.
  *  @param data A byte of data to store in the FIFO buffer.
  *  @return bool - true if data is successfully stored in the FIFO.
- *  @note Assumes that FIFO_Init has been called.
+ *  @note Assumes that FIFO_Init has been called. Only one thread may put at a time.
  */
 bool FIFO_Put(TFIFO* const FIFO, const uint8_t data);
 
-/*! @brief Get one character from the FIFO.
+/*! @brief Put one character into the FIFO if it is not full, without waiting.
+ *
+ *  @param FIFO A pointer to a FIFO struct where data is to be stored.
+ *  @param data A byte of data to store in the FIFO buffer.
+ *  @return bool - true if data is successfully stored in the FIFO.
+ *  @note Can be called from an ISR. Only one thread or ISR may put at a time.
+ */
+bool FIFO_TryPut(TFIFO* const FIFO, const uint8_t data);
+
+/*! @brief Get one character from the FIFO, waiting for data if it is empty.
  *
  *  @param FIFO A pointer to a FIFO struct with data to be retrieved.
  *  @param dataPtr A pointer to a memory location to place the retrieved byte.
  *  @return bool - true if data is successfully retrieved from the FIFO.
- *  @note Assumes that FIFO_Init has been called.
+ *  @note Assumes that FIFO_Init has been called. Only one thread may get at a time.
  */
 bool FIFO_Get(TFIFO* const FIFO, uint8_t* const dataPtr);
 
+/*! @brief Get one character from the FIFO if it is not empty, without waiting.
+ *
+ *  @param FIFO A pointer to a FIFO struct with data to be retrieved.
+ *  @param dataPtr A pointer to a memory location to place the retrieved byte.
+ *  @return bool - true if data is successfully retrieved from the FIFO.
+ *  @note Can be called from an ISR. Only one thread or ISR may get at a time.
+ */
+bool FIFO_TryGet(TFIFO* const FIFO, uint8_t* const dataPtr);
+
+/*! @brief Puts a block of bytes into the FIFO, waiting for space if it is full.
+ *
+ *  Copies as many bytes as there is room for, in at most two pieces either side of the end
+ *  of the buffer, and makes them visible to the consumer all at once.
+ *  @param FIFO A pointer to a FIFO struct where data is to be stored.
+ *  @param data A pointer to the bytes to store.
+ *  @param length Number of bytes to store.
+ *  @return uint16_t number of bytes stored, at least one unless length is 0.
+ *  @note Assumes that FIFO_Init has been called. Only one thread may put at a time.
+ */
+uint16_t FIFO_PutBlock(TFIFO* const FIFO, const uint8_t* const data, const uint16_t length);
+
+/*! @brief Gets a block of bytes from the FIFO, waiting for data if it is empty.
+ *
+ *  Copies as many bytes as the FIFO holds, up to length, in at most two pieces either side
+ *  of the end of the buffer, and frees their space all at once.
+ *  @param FIFO A pointer to a FIFO struct with data to be retrieved.
+ *  @param data A pointer to a memory location to place the retrieved bytes.
+ *  @param length Largest number of bytes to retrieve.
+ *  @return uint16_t number of bytes retrieved, at least one unless length is 0.
+ *  @note Assumes that FIFO_Init has been called. Only one thread may get at a time.
+ */
+uint16_t FIFO_GetBlock(TFIFO* const FIFO, uint8_t* const data, const uint16_t length);
+
+/*! @brief Gets the oldest bytes in the FIFO that are next to each other in the buffer, without removing them.
+ *
+ *  @param FIFO A pointer to a FIFO struct with data to be retrieved.
+ *  @param data A pointer to a memory location to place a pointer to the oldest byte.
+ *  @return uint16_t number of bytes from there up to the newest byte or the end of the buffer.
+ *  @note The bytes stay valid until FIFO_Discard removes them. Can be called from an ISR.
+ */
+uint16_t FIFO_Peek(TFIFO* const FIFO, const uint8_t** const data);
+
+/*! @brief Removes the oldest bytes from the FIFO, after they have been read through FIFO_Peek.
+ *
+ *  @param FIFO A pointer to a FIFO struct with data to be retrieved.
+ *  @param nbBytes Number of bytes to remove, no more than FIFO_Peek returned.
+ *  @note Can be called from an ISR.
+ */
+void FIFO_Discard(TFIFO* const FIFO, const uint16_t nbBytes);
+
 #endif
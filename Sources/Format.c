@@ -0,0 +1,95 @@
+/*! @file
+ *
+ *  @brief Routines for formatting numbers as text.
+ *
+ *  This contains the functions that turn whole numbers, time fields and 32Q16 numbers
+ *  into decimal digits without snprintf. Nothing is allocated, no variable arguments are
+ *  used and the number of characters written is bounded by the constants in Format.h.
+ *
+ *  @author Zhengjie Huang
+ *  @date 2017-10-17
+ */
+
+#include "Format.h"
+#include "Math.h"
+
+// The two digits of every number from 0 to 99, so digits are produced a pair at a time
+static const char DigitPairs[200] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+// Scale of the fraction for each number of decimals
+static const uint16_t DecimalScale[5] = {1, 10, 100, 1000, 10000};
+
+/*! @brief Writes a number as a fixed number of digits, with leading zeros.
+ *
+ *  @param buffer A pointer to a memory location to place the digits.
+ *  @param value The number, less than 10 to the power of nbDigits.
+ *  @param nbDigits Number of digits to write.
+ */
+void Format_Digits(char* const buffer, uint16_t value, uint8_t nbDigits)
+{
+  // Fill from the right, two digits per division by a constant
+  while (nbDigits >= 2)
+  {
+    const char* const pair = &DigitPairs[(value % 100) * 2];
+
+    nbDigits -= 2;
+    buffer[nbDigits]     = pair[0];
+    buffer[nbDigits + 1] = pair[1];
+    value /= 100;
+  }
+
+  if (nbDigits)
+    buffer[0] = (char)('0' + value);
+}
+
+/*! @brief Writes a number in as few digits as it needs.
+ *
+ *  @param buffer A pointer to a memory location to place the digits.
+ *  @param value The number.
+ *  @return uint8_t number of characters written, at most FORMAT_UNSIGNED_MAX_LENGTH.
+ */
+uint8_t Format_Unsigned(char* const buffer, const uint16_t value)
+{
+  uint8_t nbDigits;
+
+  if (value < 10)
+    nbDigits = 1;
+  else if (value < 100)
+    nbDigits = 2;
+  else if (value < 1000)
+    nbDigits = 3;
+  else if (value < 10000)
+    nbDigits = 4;
+  else
+    nbDigits = 5;
+
+  Format_Digits(buffer, value, nbDigits);
+  return nbDigits;
+}
+
+/*! @brief Writes a 32Q16 number as its integer part, a point and a fixed number of decimals.
+ *
+ *  @param buffer A pointer to a memory location to place the text.
+ *  @param number The number in 32Q16 format.
+ *  @param nbDecimals Number of decimals, 1 to 4. The last one is rounded down.
+ *  @return uint8_t number of characters written, at most FORMAT_Q16_MAX_LENGTH(nbDecimals).
+ *  @note The integer part is cut to 16 bits.
+ */
+uint8_t Format_Q16(char* const buffer, const uint32_t number, const uint8_t nbDecimals)
+{
+  uint8_t length = Format_Unsigned(buffer, (uint16_t)(number >> 16));
+
+  buffer[length++] = '.';
+  Format_Digits(&buffer[length], Math_Q16Fraction(number, DecimalScale[nbDecimals]), nbDecimals);
+  return length + nbDecimals;
+}
@@ -0,0 +1,50 @@
+/*! @file
+ *
+ *  @brief Routines for formatting numbers as text.
+ *
+ *  This contains the functions that turn whole numbers, time fields and 32Q16 numbers
+ *  into decimal digits without snprintf. Nothing is allocated, no variable arguments are
+ *  used and the number of characters written is bounded by the constants below.
+ *
+ *  @author Zhengjie Huang
+ *  @date 2017-10-17
+ */
+
+#ifndef FORMAT_H
+#define FORMAT_H
+
+// new types
+#include "types.h"
+
+// Most characters written by Format_Unsigned
+#define FORMAT_UNSIGNED_MAX_LENGTH 5
+
+// Most characters written by Format_Q16: up to 5 integer digits, the point and the decimals
+#define FORMAT_Q16_MAX_LENGTH(nbDecimals) (FORMAT_UNSIGNED_MAX_LENGTH + 1 + (nbDecimals))
+
+/*! @brief Writes a number as a fixed number of digits, with leading zeros.
+ *
+ *  @param buffer A pointer to a memory location to place the digits.
+ *  @param value The number, less than 10 to the power of nbDigits.
+ *  @param nbDigits Number of digits to write.
+ */
+void Format_Digits(char* const buffer, uint16_t value, uint8_t nbDigits);
+
+/*! @brief Writes a number in as few digits as it needs.
+ *
+ *  @param buffer A pointer to a memory location to place the digits.
+ *  @param value The number.
+ *  @return uint8_t number of characters written, at most FORMAT_UNSIGNED_MAX_LENGTH.
+ */
+uint8_t Format_Unsigned(char* const buffer, const uint16_t value);
+
+/*! @brief Writes a 32Q16 number as its integer part, a point and a fixed number of decimals.
+ *
+ *  @param buffer A pointer to a memory location to place the text.
+ *  @param number The number in 32Q16 format.
+ *  @param nbDecimals Number of decimals, 1 to 4. The last one is rounded down.
+ *  @return uint8_t number of characters written, at most FORMAT_Q16_MAX_LENGTH(nbDecimals).
+ */
+uint8_t Format_Q16(char* const buffer, const uint32_t number, const uint8_t nbDecimals);
+
+#endif
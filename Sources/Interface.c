@@ -138,26 +138,25 @@ void PushButtonThread(void* pData)
 
 /*! @brief Initialize the Interface module before first use
  *         Create threads and initialize global variables
+ *
+ *  @return bool - TRUE if the Interface module was successfully initialized.
  */
 bool Interface_Init()
 {
-  OS_ERROR error;
-
-  Debounce_Init(DisplayChannel, PushButtonCallback, NULL);
-  Display_Init();
   PushButtonSemaphore = OS_SemaphoreCreate(0);
   DisplaySemaphore = OS_SemaphoreCreate(0);
 
   DisplayStatus = DORMANT;
   DisplayCnt = 0;
 
-  error = OS_ThreadCreate(PushButtonThread,
+  return Debounce_Init(DisplayChannel, PushButtonCallback, NULL)
+      && Display_Init()
+      && (OS_ThreadCreate(PushButtonThread,
                           NULL,
                           &PushButtonThreadStack[THREAD_STACK_SIZE - 1],
-                          6);
-  error = OS_ThreadCreate(DisplayThread,
+                          6) == OS_NO_ERROR)
+      && (OS_ThreadCreate(DisplayThread,
                           NULL,
                           &DisplayThreadStack[THREAD_STACK_SIZE - 1],
-                          9);
+                          9) == OS_NO_ERROR);
 }
-
@@ -5,6 +5,8 @@
 
 /*! @brief Initialize the Interface module before first use
  *         Create threads and initialize global variables
+ *
+ *  @return bool - TRUE if the Interface module was successfully initialized.
  */
 bool Interface_Init();
 
@@ -0,0 +1,100 @@
+/*! @file
+ *
+ *  @brief Per-cycle metering kernel.
+ *
+ *  This contains the single pass routine that accumulates the squares and the
+ *  products of one cycle of voltage and current samples.
+ *
+ *  @author Zhengjie Huang
+ *  @date 2017-10-17
+ */
+
+#include "Kernel.h"
+#include <string.h>
+
+// Define KERNEL_PORTABLE to build the C version on a Cortex-M4 for comparison
+#if defined(__ARM_FEATURE_DSP) && !defined(KERNEL_PORTABLE)
+#define KERNEL_DSP
+#endif
+
+#ifdef KERNEL_DSP
+/*! @brief acc += x.lo*y.lo + x.hi*y.hi, with x and y holding two signed 16-bit values each
+ *
+ *  @param x Two packed samples.
+ *  @param y Two packed samples.
+ *  @param acc Accumulator.
+ *  @return uint64union_t the new value of the accumulator.
+ */
+static inline uint64union_t DualMAC(const uint32_t x, const uint32_t y, uint64union_t acc)
+{
+  __asm ("smlald %0, %1, %2, %3" : "+r" (acc.s.Lo), "+r" (acc.s.Hi) : "r" (x), "r" (y));
+  return acc;
+}
+#endif
+
+/*! @brief Portable C version of Kernel_Accumulate.
+ *
+ *  @param voltage Voltage samples.
+ *  @param current Current samples.
+ *  @param nbSamples Number of samples in each array.
+ *  @param sums A pointer to the structure to receive the sums.
+ */
+void Kernel_AccumulateRef(const int16_t* const voltage, const int16_t* const current, const uint8_t nbSamples, TKernelSums* const sums)
+{
+  int64_t sumVV = 0, sumII = 0, sumVI = 0;
+
+  for (uint8_t i = 0; i < nbSamples; i++)
+  {
+    int32_t v = voltage[i];
+    int32_t c = current[i];
+
+    // Each product fits in 31 bits, accumulate in 64 bits so a cycle can never overflow
+    sumVV += v * v;
+    sumII += c * c;
+    sumVI += v * c;
+  }
+
+  sums->sumVV = sumVV;
+  sums->sumII = sumII;
+  sums->sumVI = sumVI;
+}
+
+/*! @brief Accumulates sum(V*V), sum(I*I) and sum(V*I) of a cycle in a single pass.
+ *
+ *  Uses the Cortex-M4 dual 16-bit multiply-accumulate instructions when they are available.
+ *  @param voltage Voltage samples, 4-byte aligned.
+ *  @param current Current samples, 4-byte aligned.
+ *  @param nbSamples Number of samples in each array, must be even.
+ *  @param sums A pointer to the structure to receive the sums.
+ */
+void Kernel_Accumulate(const int16_t* const voltage, const int16_t* const current, const uint8_t nbSamples, TKernelSums* const sums)
+{
+#ifdef KERNEL_DSP
+  // Two samples per word, so every SMLALD does two multiply-adds
+  uint64union_t sumVV, sumII, sumVI;
+
+  sumVV.l = 0;
+  sumII.l = 0;
+  sumVI.l = 0;
+
+  for (uint8_t i = 0; i < nbSamples / 2; i++)
+  {
+    uint32_t v, c;
+
+    // memcpy rather than a uint32_t pointer so the int16_t arrays are not read through another type.
+    // It compiles to a single LDR since the arrays are 4-byte aligned
+    memcpy(&v, &voltage[2 * i], sizeof(v));
+    memcpy(&c, &current[2 * i], sizeof(c));
+
+    sumVV = DualMAC(v, v, sumVV);
+    sumII = DualMAC(c, c, sumII);
+    sumVI = DualMAC(v, c, sumVI);
+  }
+
+  sums->sumVV = (int64_t)sumVV.l;
+  sums->sumII = (int64_t)sumII.l;
+  sums->sumVI = (int64_t)sumVI.l;
+#else
+  Kernel_AccumulateRef(voltage, current, nbSamples, sums);
+#endif
+}
@@ -0,0 +1,47 @@
+/*! @file
+ *
+ *  @brief Per-cycle metering kernel.
+ *
+ *  This contains the single pass routine that accumulates the squares and the
+ *  products of one cycle of voltage and current samples.
+ *
+ *  @author Zhengjie Huang
+ *  @date 2017-10-17
+ */
+
+#ifndef KERNEL_H
+#define KERNEL_H
+
+// new types
+#include "types.h"
+
+/*!
+ * @struct TKernelSums
+ */
+typedef struct
+{
+  int64_t sumVV;   /*!< sum(V*V), of base 100/(2^30) */
+  int64_t sumII;   /*!< sum(I*I), of base 100/(2^30) */
+  int64_t sumVI;   /*!< sum(V*I), of base 100/(2^30) */
+} TKernelSums;
+
+/*! @brief Accumulates sum(V*V), sum(I*I) and sum(V*I) of a cycle in a single pass.
+ *
+ *  Uses the Cortex-M4 dual 16-bit multiply-accumulate instructions when they are available.
+ *  @param voltage Voltage samples, 4-byte aligned.
+ *  @param current Current samples, 4-byte aligned.
+ *  @param nbSamples Number of samples in each array, must be even.
+ *  @param sums A pointer to the structure to receive the sums.
+ */
+void Kernel_Accumulate(const int16_t* const voltage, const int16_t* const current, const uint8_t nbSamples, TKernelSums* const sums);
+
+/*! @brief Portable C version of Kernel_Accumulate.
+ *
+ *  @param voltage Voltage samples.
+ *  @param current Current samples.
+ *  @param nbSamples Number of samples in each array.
+ *  @param sums A pointer to the structure to receive the sums.
+ */
+void Kernel_AccumulateRef(const int16_t* const voltage, const int16_t* const current, const uint8_t nbSamples, TKernelSums* const sums);
+
+#endif
@@ -2,6 +2,28 @@
 
 #define NB_ITERATIONS 25
 
+// Seeds for the square root, indexed by the top 8 bits of a number normalized to [2^30, 2^32).
+// Entry i is sqrt((i + 64.5) * 2^24) rounded, the root of the middle of its range.
+static const uint16_t SqrtSeed[192] =
+{
+  32896, 33150, 33402, 33652, 33900, 34147, 34392, 34635, 34876, 35116, 35354, 35590,
+  35825, 36059, 36291, 36521, 36750, 36978, 37204, 37429, 37652, 37874, 38095, 38315,
+  38533, 38750, 38966, 39181, 39394, 39606, 39818, 40028, 40237, 40445, 40652, 40857,
+  41062, 41266, 41469, 41671, 41871, 42071, 42270, 42468, 42665, 42861, 43057, 43251,
+  43445, 43637, 43829, 44020, 44210, 44400, 44588, 44776, 44963, 45149, 45334, 45519,
+  45703, 45886, 46069, 46250, 46431, 46612, 46791, 46970, 47149, 47326, 47503, 47679,
+  47855, 48030, 48204, 48378, 48551, 48723, 48895, 49067, 49237, 49407, 49577, 49746,
+  49914, 50082, 50249, 50416, 50582, 50747, 50912, 51077, 51241, 51404, 51567, 51730,
+  51892, 52053, 52214, 52374, 52534, 52694, 52853, 53011, 53169, 53327, 53484, 53640,
+  53797, 53952, 54108, 54262, 54417, 54571, 54724, 54877, 55030, 55182, 55334, 55485,
+  55636, 55787, 55937, 56087, 56236, 56385, 56534, 56682, 56830, 56977, 57124, 57271,
+  57417, 57563, 57709, 57854, 57999, 58143, 58287, 58431, 58574, 58717, 58860, 59002,
+  59144, 59286, 59427, 59568, 59709, 59849, 59989, 60129, 60268, 60407, 60546, 60684,
+  60822, 60960, 61098, 61235, 61372, 61508, 61644, 61780, 61916, 62051, 62186, 62321,
+  62456, 62590, 62724, 62857, 62991, 63124, 63256, 63389, 63521, 63653, 63785, 63916,
+  64047, 64178, 64309, 64439, 64569, 64699, 64828, 64957, 65086, 65215, 65344, 65472
+};
+
 /*! @brief calculate the absolute value of a 16-bit signed integer
  *
  *  @param number signed integer
@@ -62,3 +84,64 @@ uint32_t Math_SquareRoot(uint16_t estimate, uint32_t number, uint8_t iterateTime
 }
 
 
+
+/*! @brief Calculate the square root of a 32-bit number in bounded time
+ *
+ *  Seeds from a table with 8 bits of the number, then does one Newton step and a final correction.
+ *  @param number number to be calculated
+ *  @return uint16_t square root value, rounded down
+ */
+uint16_t Math_ISqrt32(uint32_t number)
+{
+  if (number == 0)
+    return 0;
+
+  // Shift left by an even number of bits so the top two bits are not both zero
+  uint8_t shift = (uint8_t)__builtin_clz(number) & ~1u;
+  uint32_t normalized = number << shift;
+  uint32_t seed = SqrtSeed[(normalized >> 24) - 64];
+
+  // The seed is within 1/256 of the root, so one Newton step leaves an error of under one
+  uint32_t root = (seed + normalized / seed) >> 1;
+
+  // Round down. The step never undershoots by more than one and can overshoot the 16-bit range
+  if (root > 0xFFFF)
+    root = 0xFFFF;
+  root -= (root * root > normalized);
+  root += ((uint64_t)(root + 1) * (root + 1) <= normalized);
+
+  // floor(sqrt(n * 4^k)) >> k is floor(sqrt(n))
+  return (uint16_t)(root >> (shift >> 1));
+}
+
+/*! @brief Calculate the square root of a 64-bit number in bounded time
+ *
+ *  Takes the root of the upper 32 bits with Math_ISqrt32, then does one Newton step
+ *  for the lower 16 bits of the root and a final correction.
+ *  @param number number to be calculated
+ *  @return uint32_t square root value, rounded down
+ */
+uint32_t Math_ISqrt64(uint64_t number)
+{
+  uint32_t high = (uint32_t)(number >> 32);
+
+  if (high == 0)
+    return Math_ISqrt32((uint32_t)number);
+
+  // Shift left by an even number of bits so the top two bits are not both zero
+  uint8_t shift = (uint8_t)__builtin_clz(high) & ~1u;
+  uint64_t normalized = number << shift;
+  uint32_t upper = Math_ISqrt32((uint32_t)(normalized >> 32));
+
+  // The root is upper * 2^16 + d with d ~ (number - (upper * 2^16)^2) / (2 * upper * 2^16).
+  // The remainder is below 2^49 as upper is the rounded down root of the top 32 bits.
+  uint64_t remainder = normalized - ((uint64_t)upper * upper << 32);
+  uint64_t step = ((uint64_t)upper << 16) + (uint32_t)(remainder >> 17) / upper;
+
+  // The Newton step overshoots by at most one, and can overshoot the 32-bit range
+  uint32_t root = (step > 0xFFFFFFFF) ? 0xFFFFFFFF : (uint32_t)step;
+  root -= ((uint64_t)root * root > normalized);
+
+  // floor(sqrt(n * 4^k)) >> k is floor(sqrt(n))
+  return root >> (shift >> 1);
+}
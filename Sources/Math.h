@@ -3,6 +3,31 @@
 
 #include "types.h"
 
+// Fixed-point formats, xQy is an x-bit number with y fractional bits
+typedef int16_t  T16Q8;
+typedef uint16_t TU16Q8;
+typedef int32_t  T32Q16;
+typedef uint32_t TU32Q16;
+typedef int64_t  T64Q32;
+typedef uint64_t TU64Q32;
+
+// A constant num/den in 32Q16, rounded to nearest. e.g. MATH_Q16(22235, 1000) is 22.235
+#define MATH_Q16(num, den) ((uint32_t)((((uint64_t)(num) << 16) + (den) / 2) / (den)))
+
+/*! @brief Multiplier and shift that divide by a constant
+ *
+ *  x / divisor is computed as (x * multiplier) >> shift. Choose the largest shift (at least 32)
+ *  for which the multiplier still fits in 32 bits, so the error is below x / 2^(shift + 1).
+ */
+typedef struct
+{
+  uint32_t multiplier;  /*!< 2^shift / divisor, rounded to nearest */
+  uint8_t shift;
+} TReciprocal;
+
+// Initializer for a TReciprocal, e.g. MATH_RECIPROCAL(3600, 43)
+#define MATH_RECIPROCAL(divisor, shift) {(uint32_t)(((1ULL << (shift)) + (divisor) / 2) / (divisor)), (shift)}
+
 /*! @brief calculate the absolute value of a 16-bit signed integer
  *
  *  @param number signed integer
@@ -19,6 +44,171 @@ uint16_t Math_Abs(int16_t number);
  */
 uint32_t Math_SquareRoot(uint16_t estimate, uint32_t number, uint8_t iterateTimes);
 
+/*! @brief Calculate the square root of a 32-bit number in bounded time
+ *
+ *  Seeds from a table with 8 bits of the number, then does one Newton step and a final correction.
+ *  @param number number to be calculated
+ *  @return uint16_t square root value, rounded down
+ */
+uint16_t Math_ISqrt32(uint32_t number);
+
+/*! @brief Calculate the square root of a 64-bit number in bounded time
+ *
+ *  Takes the root of the upper 32 bits with Math_ISqrt32, then does one Newton step
+ *  for the lower 16 bits of the root and a final correction.
+ *  @param number number to be calculated
+ *  @return uint32_t square root value, rounded down
+ */
+uint32_t Math_ISqrt64(uint64_t number);
+
+/*! @brief Saturate a 32-bit number to 16 bits
+ *
+ *  @param number number to be saturated
+ *  @return int16_t number clamped to the range of int16_t
+ */
+static inline int16_t Math_SatS16(int32_t number)
+{
+  if (number > INT16_MAX)
+    return INT16_MAX;
+  if (number < INT16_MIN)
+    return INT16_MIN;
+  return (int16_t)number;
+}
+
+/*! @brief Saturate an unsigned 64-bit number to 16 bits
+ *
+ *  @param number number to be saturated
+ *  @return uint16_t number clamped to the range of uint16_t
+ */
+static inline uint16_t Math_SatU16(uint64_t number)
+{
+  return (number > UINT16_MAX) ? UINT16_MAX : (uint16_t)number;
+}
+
+/*! @brief Saturate a 64-bit number to 32 bits
+ *
+ *  @param number number to be saturated
+ *  @return int32_t number clamped to the range of int32_t
+ */
+static inline int32_t Math_SatS32(int64_t number)
+{
+  if (number > INT32_MAX)
+    return INT32_MAX;
+  if (number < INT32_MIN)
+    return INT32_MIN;
+  return (int32_t)number;
+}
+
+/*! @brief Saturate an unsigned 64-bit number to 32 bits
+ *
+ *  @param number number to be saturated
+ *  @return uint32_t number clamped to the range of uint32_t
+ */
+static inline uint32_t Math_SatU32(uint64_t number)
+{
+  return (number > UINT32_MAX) ? UINT32_MAX : (uint32_t)number;
+}
+
+/*! @brief Drop fractional bits, rounding to nearest (halves away from minus infinity)
+ *
+ *  e.g. Math_ShiftRound(x, 16) converts 64Q32 to 64Q16.
+ *  @param number number to be converted
+ *  @param shift number of fractional bits to drop, 1 to 63
+ *  @return int64_t rounded number
+ */
+static inline int64_t Math_ShiftRound(int64_t number, uint8_t shift)
+{
+  return (number + ((int64_t)1 << (shift - 1))) >> shift;
+}
+
+/*! @brief Multiply two 32-bit numbers into 64 bits, e.g. 32Q16 * 32Q16 = 64Q32
+ *
+ *  @param a first factor
+ *  @param b second factor
+ *  @return int64_t exact product
+ */
+static inline int64_t Math_MulWide(int32_t a, int32_t b)
+{
+  return (int64_t)a * b;
+}
+
+/*! @brief Multiply two unsigned 32-bit numbers into 64 bits, e.g. 32Q16 * 32Q16 = 64Q32
+ *
+ *  @param a first factor
+ *  @param b second factor
+ *  @return uint64_t exact product
+ */
+static inline uint64_t Math_MulWideU(uint32_t a, uint32_t b)
+{
+  return (uint64_t)a * b;
+}
+
+/*! @brief Multiply two 32-bit numbers and add the 64-bit product to an accumulator
+ *
+ *  @param accumulator running sum
+ *  @param a first factor
+ *  @param b second factor
+ *  @return int64_t accumulator + a * b
+ */
+static inline int64_t Math_MulAcc(int64_t accumulator, int32_t a, int32_t b)
+{
+  return accumulator + (int64_t)a * b;
+}
+
+/*! @brief Multiply two 32Q16 numbers
+ *
+ *  @param a first factor in 32Q16
+ *  @param b second factor in 32Q16
+ *  @return int32_t product in 32Q16, rounded to nearest and saturated
+ */
+static inline int32_t Math_MulQ16(int32_t a, int32_t b)
+{
+  return Math_SatS32(Math_ShiftRound((int64_t)a * b, 16));
+}
+
+/*! @brief Multiply a 64-bit number by a 32Q16 number
+ *
+ *  @param number number to be multiplied, in any format
+ *  @param factor factor in 32Q16
+ *  @return uint64_t (number * factor) >> 16 rounded down, in the format of number.
+ *          The result must fit in 64 bits
+ */
+static inline uint64_t Math_MulQ16Wide(uint64_t number, uint32_t factor)
+{
+  uint64_t low  = (uint64_t)(uint32_t)number * factor;
+  uint64_t high = (number >> 32) * factor;
+
+  return (high << 16) + (low >> 16);
+}
+
+/*! @brief Divide by a constant with a multiply
+ *
+ *  @param number dividend, the quotient must fit in 64 bits
+ *  @param reciprocal reciprocal of the divisor, see MATH_RECIPROCAL
+ *  @return uint64_t (number * multiplier) >> shift, exactly, which is number / divisor rounded down
+ *          or up by at most number / 2^(shift + 1)
+ */
+static inline uint64_t Math_RecipMul(uint64_t number, TReciprocal reciprocal)
+{
+  // 64 x 32-bit multiply in two halves. The low 32 bits of the lower product can not affect
+  // the result since the shift is at least 32
+  uint64_t low  = (uint64_t)(uint32_t)number * reciprocal.multiplier;
+  uint64_t high = (number >> 32) * reciprocal.multiplier;
+
+  return (high + (low >> 32)) >> (reciprocal.shift - 32);
+}
+
+/*! @brief Get the fractional part of a 32Q16 number as decimal digits
+ *
+ *  @param number number in 32Q16
+ *  @param scale 10 for one digit, 100 for two, 1000 for three
+ *  @return uint16_t fractional part * scale, rounded down
+ */
+static inline uint16_t Math_Q16Fraction(uint32_t number, uint16_t scale)
+{
+  return (uint16_t)(((number & 0xFFFF) * (uint32_t)scale) >> 16);
+}
+
 #endif
 
 
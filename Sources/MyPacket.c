@@ -2,22 +2,46 @@
  *
  *  @brief Routines to implement packet encoding and decoding for the serial port.
  *
- *  This contains the functions for implementing the "Tower to PC Protocol" 5-byte packets.
+ *  This contains the functions for implementing the "Tower to PC Protocol" 5-byte packets,
+ *  and the COBS framed mode that can be used instead of them.
  *
  *  @author Zhengjie Huang
  *  @date 2017-07-30
  */
 
+#include <stddef.h>
 #include "MyPacket.h"
 #include "UART.h"
 #include "Flash.h"
 #include "Cpu.h"
 #include "OS.h"
+#include "Crc.h"
+
+// Longest received frame once COBS encoded, without its 0 delimiter
+#define RX_FRAME_SIZE (PACKET_FRAME_OVERHEAD + PACKET_FRAME_MAX_RX_PAYLOAD + 1)
+
+// Longest run of non-zero bytes a COBS code byte can describe
+#define COBS_MAX_RUN 254
+
+// A frame sent is its header, the head and data of the payload, and its CRC
+#define NB_FRAME_PARTS 4
+
+typedef struct
+{
+  const uint8_t* part[NB_FRAME_PARTS];  /*!< Bytes of each part, in the order they are sent */
+  uint16_t end[NB_FRAME_PARTS];         /*!< Index in the frame just after each part */
+} TFrameParts;
 
 OS_ECB* PacketSemaphore;
 
 uint8_t NbBytesInPkt;
 
+static TPacketMode Mode;                /*!< Changed with PacketSemaphore held */
+static uint8_t TxSequence;              /*!< Sequence number of the next frame sent */
+static uint8_t RxFrame[RX_FRAME_SIZE];  /*!< Frame being received, decoded in place */
+static uint8_t RxLength;                /*!< Bytes in RxFrame */
+static bool RxOverflow;                 /*!< The frame being received is too long and will be dropped */
+
 /*! @brief Initializes the packets by calling the initialization routines of the supporting software modules.
  *
  *  @param baudRate The desired baud rate in bits/sec.
@@ -27,12 +51,102 @@ uint8_t NbBytesInPkt;
 bool MyPacket_Init(const uint32_t baudRate, const uint32_t moduleClk)
 {
   NbBytesInPkt = 0;
+  Mode = PACKET_MODE_FIXED;
+  TxSequence = 0;
+  RxLength = 0;
+  RxOverflow = false;
   PacketSemaphore = OS_SemaphoreCreate(1);
   return UART_Init(baudRate, moduleClk);
 }
 
+/*! @brief Switches between 5-byte packets and COBS frames, for both directions.
+ *
+ *  @param mode The new mode.
+ *  @note Anything already queued for transmission is sent in the old mode. A partly received
+ *        packet or frame is discarded.
+ */
+void MyPacket_SetMode(const TPacketMode mode)
+{
+  OS_SemaphoreWait(PacketSemaphore, 0);
+  Mode = mode;
+  NbBytesInPkt = 0;
+  RxLength = 0;
+  RxOverflow = false;
+  OS_SemaphoreSignal(PacketSemaphore);
+}
+
+/*! @brief Decodes the COBS frame in RxFrame in place and checks it.
+ *
+ *  @return bool - TRUE if the frame is valid, and then Packet holds its command and parameters.
+ */
+static bool DecodeFrame(void)
+{
+  uint8_t in = 0;
+  uint8_t out = 0;
+
+  // Each code byte is followed by code - 1 data bytes, and stands for a 0 unless it is 0xFF or the last one
+  while (in < RxLength)
+  {
+    uint8_t code = RxFrame[in++];
+
+    if (code - 1 > RxLength - in)
+      return false;
+    for (uint8_t i = 1; i < code; i++)
+      RxFrame[out++] = RxFrame[in++];
+    if (code != COBS_MAX_RUN + 1 && in < RxLength)
+      RxFrame[out++] = 0;
+  }
+
+  if (out < PACKET_FRAME_OVERHEAD)
+    return false;
+
+  uint8_t length = RxFrame[2];
+
+  if (length != out - PACKET_FRAME_OVERHEAD || length > PACKET_FRAME_MAX_RX_PAYLOAD)
+    return false;
+
+  uint16union_t crc;
+  crc.s.Lo = RxFrame[out - 2];
+  crc.s.Hi = RxFrame[out - 1];
+  if (Crc_16(CRC_16_INIT, RxFrame, out - 2) != crc.l)
+    return false;
+
+  // The sequence number is the sender's, to spot lost frames in its own logs
+  Packet_Command    = RxFrame[0];
+  Packet_Parameter1 = (length > 0) ? RxFrame[3] : 0;
+  Packet_Parameter2 = (length > 1) ? RxFrame[4] : 0;
+  Packet_Parameter3 = (length > 2) ? RxFrame[5] : 0;
+  Packet_Checksum   = Packet_Command ^ Packet_Parameter1 ^ Packet_Parameter2 ^ Packet_Parameter3;
+  return true;
+}
+
+/*! @brief Adds a byte to the frame being received.
+ *
+ *  @param data The byte received.
+ *  @return bool - TRUE if it completed a valid frame.
+ */
+static bool GetFrameByte(const uint8_t data)
+{
+  if (data != 0)
+  {
+    if (RxLength < RX_FRAME_SIZE)
+      RxFrame[RxLength++] = data;
+    else
+      RxOverflow = true;
+    return false;
+  }
+
+  // A 0 only ever ends a frame, so after corruption the next frame is found at the next 0
+  bool valid = !RxOverflow && DecodeFrame();
+
+  RxLength = 0;
+  RxOverflow = false;
+  return valid;
+}
+
 /*! @brief Attempts to get a packet from the received data.
  *
+ *  In framed mode, a frame's payload is a packet's parameters, missing ones read as 0.
  *  @return bool - TRUE if a valid packet was received.
  */
 bool MyPacket_Get(void)
@@ -40,6 +154,9 @@ bool MyPacket_Get(void)
   uint8_t  dataPtr;
   if (UART_InChar(&dataPtr) == true)
   {
+    if (Mode == PACKET_MODE_FRAMED)
+      return GetFrameByte(dataPtr);
+
 //    EnterCritical();
     switch(NbBytesInPkt)
     {
@@ -77,6 +194,7 @@ bool MyPacket_Get(void)
           Packet_Parameter3 = Packet_Checksum;
           NbBytesInPkt = 4;
         }
+        break;
       default: // Clear all bytes
         NbBytesInPkt = 0;
     }
@@ -87,37 +205,202 @@ bool MyPacket_Get(void)
 
 
 
+/*! @brief Gets a byte of a frame.
+ *
+ *  @param frame The parts of the frame.
+ *  @param index Index of the byte in the frame.
+ *  @return uint8_t the byte.
+ */
+static uint8_t FrameByte(const TFrameParts* const frame, const uint16_t index)
+{
+  uint16_t partStart = 0;
+  uint8_t part = 0;
+
+  while (index >= frame->end[part])
+    partStart = frame->end[part++];
+  return frame->part[part][index - partStart];
+}
+
+/*! @brief Sends a span of bytes of a frame, one block for each part of the frame it covers.
+ *
+ *  @param frame The parts of the frame.
+ *  @param start Index of the first byte of the span in the frame.
+ *  @param nbBytes Number of bytes in the span.
+ *  @return bool - TRUE if the span was placed in the transmit FIFO buffer.
+ */
+static bool PutSpan(const TFrameParts* const frame, uint16_t start, uint16_t nbBytes)
+{
+  uint16_t partStart = 0;
+  bool success = true;
+
+  for (uint8_t part = 0; part < NB_FRAME_PARTS && nbBytes > 0; part++)
+  {
+    if (start < frame->end[part])
+    {
+      uint16_t count = frame->end[part] - start;
+
+      if (count > nbBytes)
+        count = nbBytes;
+      success = success && UART_OutBlock(&frame->part[part][start - partStart], count);
+      start += count;
+      nbBytes -= count;
+    }
+    partStart = frame->end[part];
+  }
+  return success;
+}
+
+/*! @brief Sends a COBS frame whose payload is a head followed by data.
+ *
+ *  The frame is encoded as it is sent, so it does not need a buffer of its own.
+ *  @param command The command.
+ *  @param head A pointer to the start of the payload.
+ *  @param headLength Number of bytes in the head.
+ *  @param data A pointer to the rest of the payload.
+ *  @param length Number of bytes of data.
+ *  @return bool - TRUE if the frame was placed in the transmit FIFO buffer.
+ *  @note Assumes PacketSemaphore is held.
+ */
+static bool PutCOBS(const uint8_t command, const uint8_t* const head, const uint8_t headLength,
+                    const uint8_t* const data, const uint8_t length)
+{
+  const uint8_t header[3] = {command, TxSequence++, headLength + length};
+  uint16union_t crc;
+  uint8_t trailer[2];
+  const uint16_t total = (uint16_t)headLength + length + PACKET_FRAME_OVERHEAD;
+  uint16_t start = 0;
+  bool success = true;
+
+  crc.l = Crc_16(Crc_16(Crc_16(CRC_16_INIT, header, sizeof(header)), head, headLength), data, length);
+  trailer[0] = crc.s.Lo;
+  trailer[1] = crc.s.Hi;
+
+  const TFrameParts frame =
+  {
+    .part = {header, head, data, trailer},
+    .end = {3, 3 + (uint16_t)headLength, 3 + (uint16_t)headLength + length, total}
+  };
+
+  for (;;)
+  {
+    uint8_t run = 0;
+
+    // Find the run of non-zero bytes up to the next 0, the end of the frame or the longest run
+    while (start + run < total && run < COBS_MAX_RUN && FrameByte(&frame, start + run) != 0)
+      run++;
+
+    success = success
+           && UART_OutChar(run + 1)
+           && PutSpan(&frame, start, run);
+
+    if (start + run == total)
+      break;
+    // Skip the 0 the code byte stands for, a longest run does not stand for one
+    start += (run == COBS_MAX_RUN) ? run : run + 1;
+  }
+
+  return success && UART_OutChar(0);
+}
+
 /*! @brief Builds a packet and places it in the transmit FIFO buffer.
  *
  *  @return bool - TRUE if a valid packet was sent.
  */
 bool MyPacket_Put(const uint8_t command, const uint8_t parameter1, const uint8_t parameter2, const uint8_t parameter3){
+  bool success;
+
   OS_SemaphoreWait(PacketSemaphore, 0);
 
-  // Send command and parameters
-  if (UART_OutChar(command) == false)
+  if (Mode == PACKET_MODE_FRAMED)
   {
-    return false;
+    const uint8_t parameters[3] = {parameter1, parameter2, parameter3};
+    success = PutCOBS(command, NULL, 0, parameters, sizeof(parameters));
   }
-  if (UART_OutChar(parameter1) == false)
+  else
   {
-    return false;
+    // Send command, parameters and checksum
+    const uint8_t packet[5] = {command, parameter1, parameter2, parameter3,
+                               command ^ parameter1 ^ parameter2 ^ parameter3};
+    success = UART_OutBlock(packet, sizeof(packet));
   }
-  if (UART_OutChar(parameter2) == false)
-  {
-    return false;
-  }
-  if (UART_OutChar(parameter3) == false)
+
+  OS_SemaphoreSignal(PacketSemaphore);
+  return success;
+}
+
+
+/*! @brief Sends a packet followed by a block of data.
+ *
+ *  The packet holds the command and the length of the data. The data is followed by its
+ *  CRC-16, low byte first. In framed mode the data is sent as a single frame's payload.
+ *  @param command The command.
+ *  @param data A pointer to the data.
+ *  @param length Number of bytes of data.
+ *  @return bool - TRUE if the frame was placed in the transmit FIFO buffer.
+ */
+bool MyPacket_PutFrame(const uint8_t command, const uint8_t* const data, const uint8_t length)
+{
+  return MyPacket_PutFrameHead(command, NULL, 0, data, length);
+}
+
+/*! @brief Sends a packet followed by a block of data that starts with a separate head.
+ *
+ *  Sends the same bytes as MyPacket_PutFrame with the head and the data joined, without copying them.
+ *  @param command The command.
+ *  @param head A pointer to the start of the data.
+ *  @param headLength Number of bytes in the head.
+ *  @param data A pointer to the rest of the data.
+ *  @param length Number of bytes in the rest of the data.
+ *  @return bool - TRUE if the frame was placed in the transmit FIFO buffer.
+ */
+bool MyPacket_PutFrameHead(const uint8_t command, const uint8_t* const head, const uint8_t headLength,
+                           const uint8_t* const data, const uint8_t length)
+{
+  uint16union_t crc;
+  bool success;
+
+  // Hold the semaphore for the whole frame so no other packet is sent in the middle of it
+  OS_SemaphoreWait(PacketSemaphore, 0);
+
+  if (Mode == PACKET_MODE_FRAMED)
   {
-    return false;
+    success = PutCOBS(command, head, headLength, data, length);
   }
-  uint8_t checksum = command ^ parameter1 ^ parameter2 ^ parameter3;
-  if (UART_OutChar(checksum) == false)
+  else
   {
-    return false;
+    const uint8_t total = headLength + length;
+    const uint8_t packet[5] = {command, total, 0, 0, command ^ total};
+    uint8_t trailer[2];
+
+    crc.l = Crc_16(Crc_16(CRC_16_INIT, head, headLength), data, length);
+    trailer[0] = crc.s.Lo;
+    trailer[1] = crc.s.Hi;
+
+    success = UART_OutBlock(packet, sizeof(packet))
+           && UART_OutBlock(head, headLength)
+           && UART_OutBlock(data, length)
+           && UART_OutBlock(trailer, sizeof(trailer));
   }
 
   OS_SemaphoreSignal(PacketSemaphore);
-  return true;
+  return success;
 }
 
+/*! @brief Sends text as it is, between packets.
+ *
+ *  @param text A pointer to the text.
+ *  @param length Number of characters.
+ *  @return bool - TRUE if the text was placed in the transmit FIFO buffer.
+ */
+bool MyPacket_PutText(const char* const text, const uint8_t length)
+{
+  bool success;
+
+  // The transmit FIFO takes one producer at a time, and a packet must not be split by text
+  OS_SemaphoreWait(PacketSemaphore, 0);
+
+  success = UART_OutBlock((const uint8_t*)text, length);
+
+  OS_SemaphoreSignal(PacketSemaphore);
+  return success;
+}
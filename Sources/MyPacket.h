@@ -2,7 +2,8 @@
  *
  *  @brief Routines to implement packet encoding and decoding for the serial port.
  *
- *  This contains the functions for implementing the "Tower to PC Protocol" 5-byte packets.
+ *  This contains the functions for implementing the "Tower to PC Protocol" 5-byte packets,
+ *  and the COBS framed mode that can be used instead of them.
  *
  *  @author Zhengjie Huang
  *  @date 2017-07-30
@@ -17,6 +18,20 @@
 // Packet structure
 #define PACKET_NB_BYTES 5
 
+// Framed mode: command, sequence number, length, payload and CRC-16, COBS encoded and ended by a 0
+#define PACKET_FRAME_OVERHEAD 5
+// Longest payload accepted in a received frame, a packet's 3 parameters
+#define PACKET_FRAME_MAX_RX_PAYLOAD 3
+
+/*!
+ * @enum TPacketMode
+ */
+typedef enum
+{
+  PACKET_MODE_FIXED,    /*!< 5-byte packets with an XOR checksum */
+  PACKET_MODE_FRAMED    /*!< COBS frames with a CRC-16 */
+} TPacketMode;
+
 #pragma pack(push)
 #pragma pack(1)
 
@@ -78,8 +93,17 @@ extern const uint8_t PACKET_ACK_MASK;
  */
 bool MyPacket_Init(const uint32_t baudRate, const uint32_t moduleClk);
 
+/*! @brief Switches between 5-byte packets and COBS frames, for both directions.
+ *
+ *  @param mode The new mode.
+ *  @note Anything already queued for transmission is sent in the old mode. A partly received
+ *        packet or frame is discarded.
+ */
+void MyPacket_SetMode(const TPacketMode mode);
+
 /*! @brief Attempts to get a packet from the received data.
  *
+ *  In framed mode, a frame's payload is a packet's parameters, missing ones read as 0.
  *  @return bool - TRUE if a valid packet was received.
  */
 bool MyPacket_Get(void);
@@ -90,4 +114,36 @@ bool MyPacket_Get(void);
  */
 bool MyPacket_Put(const uint8_t command, const uint8_t parameter1, const uint8_t parameter2, const uint8_t parameter3);
 
+/*! @brief Sends a packet followed by a block of data.
+ *
+ *  The packet holds the command and the length of the data. The data is followed by its
+ *  CRC-16, low byte first. In framed mode the data is sent as a single frame's payload.
+ *  @param command The command.
+ *  @param data A pointer to the data.
+ *  @param length Number of bytes of data.
+ *  @return bool - TRUE if the frame was placed in the transmit FIFO buffer.
+ */
+bool MyPacket_PutFrame(const uint8_t command, const uint8_t* const data, const uint8_t length);
+
+/*! @brief Sends a packet followed by a block of data that starts with a separate head.
+ *
+ *  Sends the same bytes as MyPacket_PutFrame with the head and the data joined, without copying them.
+ *  @param command The command.
+ *  @param head A pointer to the start of the data.
+ *  @param headLength Number of bytes in the head.
+ *  @param data A pointer to the rest of the data.
+ *  @param length Number of bytes in the rest of the data.
+ *  @return bool - TRUE if the frame was placed in the transmit FIFO buffer.
+ */
+bool MyPacket_PutFrameHead(const uint8_t command, const uint8_t* const head, const uint8_t headLength,
+                           const uint8_t* const data, const uint8_t length);
+
+/*! @brief Sends text as it is, between packets.
+ *
+ *  @param text A pointer to the text.
+ *  @param length Number of characters.
+ *  @return bool - TRUE if the text was placed in the transmit FIFO buffer.
+ */
+bool MyPacket_PutText(const char* const text, const uint8_t length);
+
 #endif
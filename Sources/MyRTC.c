@@ -13,10 +13,42 @@
 #include "LEDs.h"
 #include "Cpu.h"
 #include "OS.h"
+#include "Command.h"
+
+#define CMD_TIME1 0x12
+#define CMD_TIME2 0x13
 
 static void (*RTCCallback)(void*);
 static void *RTCArugments;
 
+/*! @brief Sets the minutes and seconds of the clock.
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
+ */
+static bool HandleTime1(const TCommandPacket* const packet)
+{
+  if (packet->parameter1 > 59 || packet->parameter2 > 59)
+    return false;
+
+  MyRTC_Set1(packet->parameter2, packet->parameter1);
+  return true;
+}
+
+/*! @brief Sets the days and hours of the clock.
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
+ */
+static bool HandleTime2(const TCommandPacket* const packet)
+{
+  if (packet->parameter1 > 23)
+    return false;
+
+  MyRTC_Set2(packet->parameter2, packet->parameter1);
+  return true;
+}
+
 /*! @brief Initializes the RTC before first use.
  *
  *  Sets up the control register for the RTC and locks it.
@@ -55,6 +87,9 @@ bool MyRTC_Init(void (*userFunction)(void*), void* userArguments)
   RTC_IER = RTC_IER_TSIE_MASK;
   //enable time counter
   RTC_SR |= RTC_SR_TCE_MASK;
+
+  return Command_Register(CMD_TIME1, HandleTime1)
+      && Command_Register(CMD_TIME2, HandleTime2);
 }
 
 /*! @brief Sets the value of the real time clock.
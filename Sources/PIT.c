@@ -12,26 +12,24 @@
 #include "Cpu.h"
 #include "LEDs.h"
 #include "meter.h"
-#include "analog.h"
 #include "OS.h"
 #include "DAC.h"
+#include "Bench.h"
 
 #define NANO_SECONDS_IN_A_SECOND 1000000000
 #define NANO_SECONDS_IN_10_MS 10000000
 
-#define VOLT_CHANNEL 1
-#define CURR_CHANNEL 2
+#define CORE_TICKS_PER_BUS_TICK (CPU_CORE_CLK_HZ / CPU_BUS_CLK_HZ)
 
 uint32_t ModuleClk;
 
+static uint32_t RunningLoad;   /*!< Load value of the period running since the last interrupt */
+
 bool DAC_TestMode;
 
 void (*PITCallback)(void*);
 void *PITArguments;
 
-int16_t Meter_Voltage;
-int16_t Meter_Current;
-
 /*! @brief Sets up the PIT before first use.
  *
  *  Enables the PIT and freezes the timer when debugging.
@@ -79,6 +77,7 @@ void PIT_Set(const uint32_t period, const bool restart){
     // set a new value and enable
     PIT_Enable(false);
     PIT_LDVAL0 = (period/(NANO_SECONDS_IN_A_SECOND / ModuleClk)) - 1;
+    RunningLoad = PIT_LDVAL0;
     PIT_Enable(true);
     PIT_TCTRL0 |= PIT_TCTRL_TIE_MASK;      // start Timer 0
   }
@@ -111,18 +110,31 @@ void PIT_Enable(const bool enable){
  */
 void __attribute__ ((interrupt)) PIT_ISR(void)
 {
+  // The timer reloaded and started counting down again when it timed out, so the
+  // distance it has counted since is how late the interrupt is.
+  // Read before the callback loads the period for the next tick
+  uint32_t load = PIT_LDVAL0;
+  uint32_t lateTicks = load - PIT_CVAL0;
+
   OS_ISREnter();
 
+  uint32_t start = Bench_Start();
+  Bench_Add(BENCH_PIT_LATENCY, lateTicks * CORE_TICKS_PER_BUS_TICK);
+
   // Clear the flag
   PIT_TFLG0 |= PIT_TFLG_TIF_MASK;
 
-  Analog_Get(VOLT_CHANNEL ,&Meter_Voltage);
-  Analog_Get(CURR_CHANNEL, &Meter_Current);
+  // The period that has just ended is the one that was running at the last interrupt
+  uint32_t periodTicks = RunningLoad + 1;
+  RunningLoad = load;
 
-  if (DAC_TestMode)
-    DAC_Callback();
+  // The meter samples the inputs before the test signal moves on to the next step
   if (PITCallback)
     (*PITCallback)(PITArguments);
+  if (DAC_TestMode)
+    DAC_Callback(periodTicks);
+
+  Bench_Stop(BENCH_PIT_ISR, start);
 
   OS_ISRExit();
 }
@@ -0,0 +1,151 @@
+/*! @file
+ *
+ *  @brief Software phase locked loop for tracking the mains frequency.
+ *
+ *  This contains the functions that lock the sample period to the voltage
+ *  waveform so that every block holds exactly one mains cycle.
+ *
+ *  @author Zhengjie Huang
+ *  @date 2017-10-17
+ */
+
+#include "PLL.h"
+
+// Loop gains at 16 samples per cycle: a phase error of one sample changes the period by KP ticks
+// at once and by KI ticks more for every cycle it persists.
+// The loop gain goes up with the square of the samples per cycle, so they are scaled down by it.
+// Tuned in simulation (Tests/PLLTest.c), including the one period lag of the PIT reload and +/-30 LSB
+// of noise on a 10000 LSB sine: after a 2 Hz step the loop reports lock within 13 cycles at any density.
+#define KP 1280
+#define KI 512
+#define GAIN_SAMPLES 16
+
+// Locked when the zero crossing stays within 0.05 samples of its target for 4 cycles, at 16 samples
+// per cycle. The threshold is scaled to the same time at other densities, where the same noise moves
+// the interpolated crossing by more samples.
+#define LOCK_THRESHOLD 3277
+#define LOCK_CYCLES    4
+
+/*! @brief Initializes the PLL before first use.
+ *
+ *  @param pll A pointer to the PLL.
+ *  @param nbSamples Nominal samples per cycle, the size of a block.
+ *  @param nominalTicks Sample period at the nominal frequency in bus clock ticks.
+ *  @param minTicks Shortest sample period allowed in bus clock ticks.
+ *  @param maxTicks Longest sample period allowed in bus clock ticks.
+ */
+void PLL_Init(TPLL* const pll, const uint8_t nbSamples, const uint32_t nominalTicks, const uint32_t minTicks, const uint32_t maxTicks)
+{
+  pll->nbSamples   = nbSamples;
+  pll->kp          = KP * GAIN_SAMPLES * GAIN_SAMPLES / ((int32_t)nbSamples * nbSamples);
+  pll->ki          = KI * GAIN_SAMPLES * GAIN_SAMPLES / ((int32_t)nbSamples * nbSamples);
+  pll->nominalQ16  = nominalTicks << 16;
+  pll->minQ16      = minTicks << 16;
+  pll->maxQ16      = maxTicks << 16;
+  pll->periodQ16   = pll->nominalQ16;
+  pll->integrator  = 0;
+  pll->phaseError  = 0;
+  pll->accumulator = 0;
+  pll->lastSample  = 0;
+  pll->lockCount   = 0;
+  pll->locked      = false;
+}
+
+/*! @brief Updates the PLL with one block of voltage samples.
+ *
+ *  Finds the rising zero crossing by interpolating between the samples on either side
+ *  of it, and corrects the sample period with a proportional-integral filter.
+ *  @param pll A pointer to the PLL.
+ *  @param voltage A block of voltage samples.
+ */
+void PLL_Update(TPLL* const pll, const int16_t* const voltage)
+{
+  const uint8_t nbSamples = pll->nbSamples;
+  int16_t previous = pll->lastSample;
+  bool found = false;
+  int32_t error = 0;
+
+  for (uint8_t i = 0; i < nbSamples; i++)
+  {
+    if (previous < 0 && voltage[i] >= 0)
+    {
+      // The crossing lies between sample i-1 and sample i (sample -1 is the last one of the previous block)
+      uint32_t fraction = ((uint32_t)(-previous) << 16) / (uint32_t)(voltage[i] - previous);
+      int32_t position = ((int32_t)i - 1) * 65536 + (int32_t)fraction;
+
+      // The target is 3/4 of the way through the block, so the crossing mostly
+      // depends on samples taken after the last correction was applied.
+      // Wrap the error into half a cycle either side of it
+      position -= (int32_t)nbSamples * 49152;
+      if (position >= (int32_t)nbSamples * 32768)
+        position -= (int32_t)nbSamples * 65536;
+      else if (position < -(int32_t)nbSamples * 32768)
+        position += (int32_t)nbSamples * 65536;
+
+      // Keep the crossing nearest the target if there are two
+      if (!found || (position < 0 ? -position : position) < (error < 0 ? -error : error))
+        error = position;
+      found = true;
+    }
+    previous = voltage[i];
+  }
+  pll->lastSample = previous;
+
+  if (!found)
+  {
+    // No signal to lock to, hold the current period
+    pll->lockCount = 0;
+    pll->locked = false;
+    return;
+  }
+
+  pll->phaseError = error;
+
+  // The crossing arriving late means the samples are too close together, so lengthen the period
+  int32_t integrator = pll->integrator + error * pll->ki;
+  int32_t minCorrection = (int32_t)(pll->minQ16 - pll->nominalQ16);
+  int32_t maxCorrection = (int32_t)(pll->maxQ16 - pll->nominalQ16);
+
+  if (integrator < minCorrection)
+    integrator = minCorrection;
+  else if (integrator > maxCorrection)
+    integrator = maxCorrection;
+  pll->integrator = integrator;
+
+  int32_t correction = integrator + error * pll->kp;
+
+  if (correction < minCorrection)
+    correction = minCorrection;
+  else if (correction > maxCorrection)
+    correction = maxCorrection;
+  // The period can be above INT32_MAX in 32Q16 (31250 ticks at 16 samples per cycle), so add in unsigned
+  pll->periodQ16 = pll->nominalQ16 + (uint32_t)correction;
+
+  if ((error < 0 ? -error : error) < LOCK_THRESHOLD * (int32_t)nbSamples / GAIN_SAMPLES)
+  {
+    if (pll->lockCount < LOCK_CYCLES)
+      pll->lockCount ++;
+  }
+  else
+  {
+    pll->lockCount = 0;
+  }
+  pll->locked = (pll->lockCount == LOCK_CYCLES);
+}
+
+/*! @brief Gets the whole number of ticks to load for the next sample period.
+ *
+ *  Alternates between the two nearest whole periods so that their average is the fractional period.
+ *  @param pll A pointer to the PLL.
+ *  @return uint32_t period in bus clock ticks.
+ *  @note Call once per sample period.
+ */
+uint32_t PLL_NextPeriod(TPLL* const pll)
+{
+  uint32_t period = pll->periodQ16;
+  uint32_t sum = (uint32_t)pll->accumulator + (period & 0xFFFF);
+
+  pll->accumulator = (uint16_t)sum;
+  // Carry out of the fractional part adds one tick to this period
+  return (period >> 16) + (sum >> 16);
+}
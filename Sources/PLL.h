@@ -0,0 +1,66 @@
+/*! @file
+ *
+ *  @brief Software phase locked loop for tracking the mains frequency.
+ *
+ *  This contains the functions that lock the sample period to the voltage
+ *  waveform so that every block holds exactly one mains cycle.
+ *
+ *  @author Zhengjie Huang
+ *  @date 2017-10-17
+ */
+
+#ifndef PLL_H
+#define PLL_H
+
+// new types
+#include "types.h"
+
+/*!
+ * @struct TPLL
+ */
+typedef struct
+{
+  uint32_t periodQ16;     /*!< Sample period in bus clock ticks, 32Q16 */
+  uint32_t nominalQ16;    /*!< Sample period at the nominal frequency */
+  uint32_t minQ16;        /*!< Shortest period allowed (highest frequency) */
+  uint32_t maxQ16;        /*!< Longest period allowed (lowest frequency) */
+  int32_t integrator;     /*!< Frequency correction in ticks, 32Q16 */
+  int32_t kp;             /*!< Proportional gain, ticks per sample of phase error */
+  int32_t ki;             /*!< Integral gain, ticks per sample of phase error per cycle */
+  int32_t phaseError;     /*!< Position of the last zero crossing from its target, in samples, 32Q16 */
+  uint16_t accumulator;   /*!< Fractional part of the period carried from tick to tick */
+  int16_t lastSample;     /*!< Last voltage sample of the previous block */
+  uint8_t nbSamples;      /*!< Nominal samples per cycle */
+  uint8_t lockCount;      /*!< Consecutive cycles with a small phase error */
+  bool locked;            /*!< TRUE once the loop has settled */
+} TPLL;
+
+/*! @brief Initializes the PLL before first use.
+ *
+ *  @param pll A pointer to the PLL.
+ *  @param nbSamples Nominal samples per cycle, the size of a block.
+ *  @param nominalTicks Sample period at the nominal frequency in bus clock ticks.
+ *  @param minTicks Shortest sample period allowed in bus clock ticks.
+ *  @param maxTicks Longest sample period allowed in bus clock ticks.
+ */
+void PLL_Init(TPLL* const pll, const uint8_t nbSamples, const uint32_t nominalTicks, const uint32_t minTicks, const uint32_t maxTicks);
+
+/*! @brief Updates the PLL with one block of voltage samples.
+ *
+ *  Finds the rising zero crossing by interpolating between the samples on either side
+ *  of it, and corrects the sample period with a proportional-integral filter.
+ *  @param pll A pointer to the PLL.
+ *  @param voltage A block of voltage samples.
+ */
+void PLL_Update(TPLL* const pll, const int16_t* const voltage);
+
+/*! @brief Gets the whole number of ticks to load for the next sample period.
+ *
+ *  Alternates between the two nearest whole periods so that their average is the fractional period.
+ *  @param pll A pointer to the PLL.
+ *  @return uint32_t period in bus clock ticks.
+ *  @note Call once per sample period.
+ */
+uint32_t PLL_NextPeriod(TPLL* const pll);
+
+#endif
@@ -1,68 +1,55 @@
 #include "MyPacket.h"
 #include "OS.h"
 #include "Protocol.h"
-#include "Tariff.h"
 #include "Cpu.h"
 #include "DAC.h"
 #include "meter.h"
 #include "MyRTC.h"
+#include "Math.h"
+#include "Command.h"
 
 #define THREAD_STACK_SIZE 100
 
-// Basic Protocol
-#define CMD_TEST   0x10
-#define CMD_TARIFF 0x11
-#define CMD_TIME1  0x12
-#define CMD_TIME2  0x13
-#define CMD_POWER  0x14
-#define CMD_ENERGY 0x15
-#define CMD_COST   0x16
-
-// Intermediate Protocol
-#define CMD_FREQUENCY    0x17
-#define CMD_VOLTAGE_RMS  0x18
-#define CMD_CURRENT_RMS  0x19
-#define CMD_POWER_FACTOR 0x1A
-
-// Other protocol
-#define CMD_VOLTAGE_AMP  0x1B
-#define CMD_CURRENT_AMP  0x1C
-#define CMD_PHASE        0x1D
+// Commands handled here. The other modules register their own commands when they are initialized:
+//   0x11, 0x21-0x24              Tariff.c
+//   0x12, 0x13                   MyRTC.c
+//   0x14-0x1A, 0x1F, 0x20, 0x25  meter.c
+//   0x1B-0x1D, 0x2F, 0x30        DAC.c
+//   0x1E                         Bench.c
+//   0x29-0x2B                    Capture.c
+//   0x2D                         Command.c
+//   0x2E                         Display.c
+#define CMD_TEST            0x10
+#define CMD_SNAPSHOT        0x26
+#define CMD_SUBSCRIBE       0x27
+#define CMD_UNSUBSCRIBE     0x28
+#define CMD_FRAMING         0x2C
+
+// Bytes in a snapshot frame
+#define SNAPSHOT_SIZE 22
+
+static const TReciprocal PerHour = MATH_RECIPROCAL(3600, 43);
 
 OS_THREAD_STACK(ProtocolThreadStack, THREAD_STACK_SIZE); /*!< The stack for the Packet Handle thread. */
+OS_THREAD_STACK(TelemetryThreadStack, THREAD_STACK_SIZE); /*!< The stack for the telemetry thread. */
 
-static bool TestMode = false;
-
-uint32_t Meter_AveragePower;
-uint64_t Meter_Energy;
-uint64_t Meter_Cost;
-uint16_t Meter_PowerFactor;
-
-uint16_t Meter_VoltageRMS;
-uint16_t Meter_CurrentRMS;
-
-
-bool HandleTariff()
-{
-  // Get Tariff
-  if (Packet_Parameter2 == 1)
-    return MyPacket_Put(CMD_TARIFF, Tariff_GetMode(), Packet_Parameter2, Packet_Parameter3);
-
-  // Tariff range out of scope
-  if (!(Packet_Parameter1 == 3 || Packet_Parameter1 == 1 || Packet_Parameter1 == 2))
-    return false;
-
-  if (Packet_Parameter2 == 0)
-    return Tariff_Set((uint8_t)Packet_Parameter1);
+/*! @brief Semaphore for telemetry thread, signaled by the meter thread when a record is due
+ *
+ */
+static OS_ECB* TelemetrySemaphore;
 
-  return false;
-}
+static bool TestMode = false;
 
-bool HandleTest()
+/*! @brief Turns the test waveform on or off (parameter 2 = 0) or gets whether it is on (parameter 2 = 1).
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
+ */
+static bool HandleTest(const TCommandPacket* const packet)
 {
-  if (Packet_Parameter2 == 0)
+  if (packet->parameter2 == 0)
   {
-    TestMode = (bool)Packet_Parameter1;
+    TestMode = (bool)packet->parameter1;
     if (TestMode)
       DAC_Start();
     else
@@ -70,176 +57,135 @@ bool HandleTest()
     return true;
   }
 
-  if (Packet_Parameter2 == 1)
+  if (packet->parameter2 == 1)
   {
-    return MyPacket_Put(CMD_TEST, DAC_GetMode(), Packet_Parameter2, Packet_Parameter3);
+    return MyPacket_Put(CMD_TEST, DAC_GetMode(), packet->parameter2, packet->parameter3);
   }
 
   return false;
 }
 
-bool HandleTime1()
-{
-  if (Packet_Parameter1 > 59 || Packet_Parameter2 > 59)
-    return false;
-
-  MyRTC_Set1(Packet_Parameter2, Packet_Parameter1);
-  return true;
-}
-
-bool HandleTime2()
-{
-  if (Packet_Parameter1 > 23)
-    return false;
-
-  MyRTC_Set2(Packet_Parameter2, Packet_Parameter1);
-  return true;
-}
-
-bool HandlePower()
-{
-  uint16union_t power;
-  power.l = (uint16_t)((Meter_AveragePower*1000) >> 16);
-  return MyPacket_Put(CMD_POWER, power.s.Lo, power.s.Hi, 0);
-}
-
-bool HandleEnergy()
-{
-  uint16union_t energy;
-  energy.l = (uint16_t)(((uint32_t)(Meter_Energy>>16) / 3600) >> 16);
-  return MyPacket_Put(CMD_ENERGY, energy.s.Lo, energy.s.Hi, 0);
-}
-
-bool HandleCost()
+/*! @brief Stores a value in a buffer, low byte first
+ *
+ *  @param buffer A pointer to the buffer
+ *  @param value The value
+ *  @param nbBytes Number of bytes of the value to store
+ *  @return uint8_t* pointer to the byte after the value
+ */
+static uint8_t* PutLittleEndian(uint8_t* buffer, uint32_t value, const uint8_t nbBytes)
 {
-  uint32_t totalCents = (uint32_t)(Meter_Cost >> 32);
-  uint8_t cents = totalCents % 100;
-  uint16union_t dollars;
-  dollars.l = cents/100;
-
-  return MyPacket_Put(CMD_COST, cents, dollars.s.Lo, dollars.s.Hi);
+  for (uint8_t i = 0; i < nbBytes; i++)
+  {
+    *buffer++ = (uint8_t)value;
+    value >>= 8;
+  }
+  return buffer;
 }
 
-bool HandleFrequency()
+/*! @brief Builds a snapshot frame from the latest measurements
+ *
+ *  @param frame A pointer to a buffer of SNAPSHOT_SIZE bytes
+ *  @param cycle A pointer to a memory location to place the number of the cycle, or NULL
+ *  @return uint8_t number of bytes in the frame
+ */
+static uint8_t BuildSnapshot(uint8_t* const frame, uint32_t* const cycle)
 {
-  uint16union_t freq;
-  freq.l = 525 - Meter_GetFrequencyDiff();
-  return MyPacket_Put(Packet_Command, freq.s.Lo, freq.s.Hi, 0);
+  TMeterSnapshot snapshot;
+  uint8_t* p = frame;
+
+  Meter_GetSnapshot(&snapshot);
+  if (cycle)
+    *cycle = snapshot.cycle;
+
+  // Same units as the single value commands, but wider where they would saturate
+  p = PutLittleEndian(p, snapshot.cycle, 4);
+  // 32Q16 kW to W
+  p = PutLittleEndian(p, Math_SatU16(Math_MulWideU(snapshot.averagePower, 1000) >> 16), 2);
+  // 64Q32 Joule to Wh
+  p = PutLittleEndian(p, Math_SatU32(Math_RecipMul(snapshot.energy, PerHour) >> 32), 4);
+  // 64Q32 cents to cents
+  p = PutLittleEndian(p, Math_SatU32(snapshot.cost >> 32), 4);
+  p = PutLittleEndian(p, Math_SatU16(snapshot.frequency), 2);
+  p = PutLittleEndian(p, snapshot.voltageRMS, 2);
+  p = PutLittleEndian(p, snapshot.currentRMS, 2);
+  p = PutLittleEndian(p, ((uint32_t)snapshot.powerFactor * 1000) >> 8, 2);
+
+  return (uint8_t)(p - frame);
 }
 
-bool HandleVoltageRMS()
+/*! @brief Sends all the measurements of the same cycle in one frame.
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
+ */
+static bool HandleSnapshot(const TCommandPacket* const packet)
 {
-  uint16union_t volt;
-  volt.l = Meter_VoltageRMS;
+  uint8_t frame[SNAPSHOT_SIZE];
+  uint8_t length = BuildSnapshot(frame, NULL);
 
-  return MyPacket_Put(Packet_Command, volt.s.Lo, volt.s.Hi, 0);
+  return MyPacket_PutFrame(CMD_SNAPSHOT, frame, length);
 }
 
-bool HandleCurrentRMS()
+/*! @brief Starts or changes the period of the telemetry pushes, in cycles in parameters 1 and 2.
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
+ */
+static bool HandleSubscribe(const TCommandPacket* const packet)
 {
-  uint16union_t curr;
-  curr.l = Meter_CurrentRMS;
+  uint16union_t period;
+  period.s.Lo = packet->parameter1;
+  period.s.Hi = packet->parameter2;
 
-  return MyPacket_Put(Packet_Command, curr.s.Lo, curr.s.Hi, 0);
-}
-
-bool HandlePowerFactor()
-{
-  uint16union_t pf;
-  pf.l = (uint16_t)(((uint32_t)Meter_PowerFactor*1000) >> 8);
+  // Sending it again while subscribed changes the period
+  if (period.l == 0 || !Meter_SetTelemetry(period.l, TelemetrySemaphore))
+    return false;
 
-  return MyPacket_Put(Packet_Command, pf.s.Lo, pf.s.Hi, 0);
+  return MyPacket_Put(CMD_SUBSCRIBE, period.s.Lo, period.s.Hi, 0);
 }
 
-bool HandleVoltageAmp()
+/*! @brief Stops the telemetry pushes.
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
+ */
+static bool HandleUnsubscribe(const TCommandPacket* const packet)
 {
-  uint16union_t steps;
-  steps.s.Lo = Packet_Parameter1;
-  steps.s.Hi = Packet_Parameter2;
-
-  if (steps.l > 2317)
-    return false;
-
-  DAC_SetVoltageAmp(steps.l);
-  return true;
+  (void)Meter_SetTelemetry(0, TelemetrySemaphore);
+  return MyPacket_Put(CMD_UNSUBSCRIBE, 0, 0, 0);
 }
 
-bool HandleCurrentAmp()
+/*! @brief Switches between 5-byte packets (parameter 1 = 0) and COBS frames (parameter 1 = 1).
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
+ */
+static bool HandleFraming(const TCommandPacket* const packet)
 {
-  uint16union_t steps;
-  steps.s.Lo = Packet_Parameter1;
-  steps.s.Hi = Packet_Parameter2;
-
-  if (steps.l > 23170)
+  if (packet->parameter1 != PACKET_MODE_FIXED && packet->parameter1 != PACKET_MODE_FRAMED)
     return false;
 
-  DAC_SetCurrentAmp(steps.l);
-  return true;
-}
-
-bool HandlePhase()
-{
-  if (Packet_Parameter1 > 32)
+  // The reply goes out in the mode the request came in, everything after it in the new one
+  if (!MyPacket_Put(CMD_FRAMING, packet->parameter1, 0, 0))
     return false;
 
-  DAC_SetPhase(Packet_Parameter1);
+  MyPacket_SetMode((TPacketMode)packet->parameter1);
   return true;
 }
 
 static void HandlePacket()
 {
-  static bool success;
-
   if (MyPacket_Get())
   {
-    switch (Packet_Command)
+    const TCommandPacket packet =
     {
-      case CMD_TARIFF:
-        success = HandleTariff();
-        break;
-      case CMD_TEST:
-        success = HandleTest();
-        break;
-      case CMD_TIME1:
-        success = HandleTime1();
-        break;
-      case CMD_TIME2:
-        success = HandleTime2();
-        break;
-      case CMD_POWER:
-        success = HandlePower();
-        break;
-      case CMD_ENERGY:
-        success = HandleEnergy();
-        break;
-      case CMD_COST:
-        success = HandleCost();
-        break;
-
-      // Intermediate protocol
-      case CMD_FREQUENCY:
-        success = HandleFrequency();
-        break;
-      case CMD_VOLTAGE_RMS:
-        success = HandleVoltageRMS();
-        break;
-      case CMD_CURRENT_RMS:
-        success = HandleCurrentRMS();
-        break;
-      case CMD_POWER_FACTOR:
-        success = HandlePowerFactor();
-        break;
-
-      case CMD_VOLTAGE_AMP:
-        success = HandleVoltageAmp();
-        break;
-      case CMD_CURRENT_AMP:
-        success = HandleCurrentAmp();
-        break;
-      case CMD_PHASE:
-        success = HandlePhase();
-        break;
-    }
+      .command    = Packet_Command,
+      .parameter1 = Packet_Parameter1,
+      .parameter2 = Packet_Parameter2,
+      .parameter3 = Packet_Parameter3
+    };
+
+    (void)Command_Dispatch(&packet);
   }
 }
 
@@ -255,6 +201,31 @@ void ProtocolThread(void* pData)
   }
 }
 
+/*! @brief Thread to push a snapshot whenever the meter thread signals a telemetry record is due
+ *
+ *  @param pData Thread data
+ */
+void TelemetryThread(void* pData)
+{
+  uint8_t frame[SNAPSHOT_SIZE];
+  uint32_t lastCycle = 0;
+
+  for (;;)
+  {
+    (void)OS_SemaphoreWait(TelemetrySemaphore, 0);
+
+    uint32_t cycle;
+    uint8_t length = BuildSnapshot(frame, &cycle);
+
+    // Semaphore count left over while the link was busy, the latest record has already been sent
+    if (cycle == lastCycle)
+      continue;
+    lastCycle = cycle;
+
+    (void)MyPacket_PutFrame(CMD_SNAPSHOT, frame, length);
+  }
+}
+
 /*! @brief RTC callback used to manipulate time increment
  *
  */
@@ -278,11 +249,24 @@ void RTCCallback()
  */
 void Protocol_Init()
 {
+  (void)Command_Register(CMD_TEST, HandleTest);
+  (void)Command_Register(CMD_SNAPSHOT, HandleSnapshot);
+  (void)Command_Register(CMD_SUBSCRIBE, HandleSubscribe);
+  (void)Command_Register(CMD_UNSUBSCRIBE, HandleUnsubscribe);
+  (void)Command_Register(CMD_FRAMING, HandleFraming);
+
   MyRTC_Init(RTCCallback, NULL);
   OS_ThreadCreate(ProtocolThread,
                   NULL,
                   &ProtocolThreadStack[THREAD_STACK_SIZE - 1],
                   5);
+
+  TelemetrySemaphore = OS_SemaphoreCreate(0);
+  // Above the protocol thread so requests do not hold up records that are due
+  OS_ThreadCreate(TelemetryThread,
+                  NULL,
+                  &TelemetryThreadStack[THREAD_STACK_SIZE - 1],
+                  4);
 }
 
 /*! @brief Get what a second represents
@@ -295,12 +279,12 @@ uint32_t Protocol_GetTime(uint8_t ratio)
   // Returns a 32Q16 number
   if (TestMode)
   {
-    // Accelerated time: 0.00125s*3600
-    return (uint32_t)((0.00125 * 65536 * 3600) * ratio);
+    // Accelerated time: one sample period * 3600
+    return (uint32_t)SAMPLE_PERIOD_Q16_X100 * 3600 * ratio / 100;
   }
   else
   {
-    // Normal time: 0.00125s
-    return (uint32_t)((0.00125 * 65536) * ratio);
+    // Normal time: one sample period (0.00125 s at 16 samples per cycle)
+    return (uint32_t)SAMPLE_PERIOD_Q16_X100 * ratio / 100;
   }
 }
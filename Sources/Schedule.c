@@ -0,0 +1,513 @@
+/*! @file
+ *
+ *  @brief Time-of-use tariff schedule.
+ *
+ *  This contains the functions for loading a time-of-use schedule from Flash and finding
+ *  the tariff band in force at a given time. A schedule has up to 8 bands, up to 4 seasons
+ *  and different day profiles for weekdays and weekends. It is uploaded over the serial
+ *  port one half word at a time and then committed to Flash.
+ *
+ *  @author Zhengjie Huang
+ *  @date 2017-10-17
+ */
+
+#include "Schedule.h"
+#include "Crc.h"
+#include "Math.h"
+#include "Cpu.h"
+
+// The schedule has a 4 KiB sector of its own, after the one used by the Flash module
+#define SCHEDULE_FLASH_START 0x00081000LU
+
+#define FLASH_CMD_PROGRAM_PHRASE 0x07
+#define FLASH_CMD_ERASE_SECTOR   0x09
+#define FLASH_PHRASE_SIZE        8
+
+#define SECONDS_PER_DAY  86400
+#define DAYS_PER_YEAR    365
+#define DAYS_PER_CYCLE   (4 * DAYS_PER_YEAR + 1)   // A leap year every 4 years
+#define LEAP_DAY         59                        // Day of the year of 29 February in a leap year
+
+// Stops the compiler moving accesses to a schedule or index across a read or update of Generation
+#define COMPILER_BARRIER() __asm__ volatile ("" ::: "memory")
+
+// The schedule is programmed a phrase at a time
+typedef char ScheduleSizeCheck[(sizeof(TSchedule) % FLASH_PHRASE_SIZE == 0) ? 1 : -1];
+
+/*!
+ * @struct TBoundary
+ */
+typedef struct
+{
+  uint32_t start;       /*!< Second of the day the band starts */
+  uint8_t band;
+} TBoundary;
+
+/*!
+ * @struct TScheduleIndex
+ * @brief A schedule compiled for lookup, with the switches of each profile sorted by time
+ */
+typedef struct
+{
+  const TSchedule* schedule;                        /*!< The schedule it was compiled from */
+  uint8_t first[SCHEDULE_MAX_PROFILES + 1];         /*!< Profile p is boundaries[first[p]] to boundaries[first[p + 1] - 1] */
+  TBoundary boundaries[SCHEDULE_MAX_SWITCHES];
+} TScheduleIndex;
+
+// 22.235, 4.400 and 2.109 cents/kWh
+// Peak 14:00-20:00, shoulder 7:00-14:00 and 20:00-22:00, off peak 22:00-7:00, every day
+static const TSchedule DefaultSchedule =
+{
+  .magic = SCHEDULE_MAGIC,
+  .nbBands = 3,
+  .nbSeasons = 1,
+  .nbSwitches = 5,
+  .firstWeekday = 0,
+  .rates = {MATH_Q16(22235, 1000), MATH_Q16(4400, 1000), MATH_Q16(2109, 1000)},
+  .seasonStart = {0},
+  .profiles = {{0, 0}},
+  .switches =
+  {
+    {.minute = 0,       .band = 2, .profile = 0},
+    {.minute = 7 * 60,  .band = 1, .profile = 0},
+    {.minute = 14 * 60, .band = 0, .profile = 0},
+    {.minute = 20 * 60, .band = 1, .profile = 0},
+    {.minute = 22 * 60, .band = 2, .profile = 0}
+  }
+};
+
+static TSchedule UploadBuffer __attribute__((aligned(0x04)));
+static TSchedule RAMCopies[2];                      /*!< RAMCopies[i] backs Indexes[i] while the Flash sector is rewritten */
+
+static TScheduleIndex Indexes[2];                   /*!< The one in force and the one being compiled */
+static TScheduleIndex* volatile Active;
+static volatile uint32_t Generation;                /*!< Changed before a schedule or index readers may hold is rewritten */
+
+/*! @brief Compiles a schedule into an index, checking that it is consistent.
+ *
+ *  @param schedule The schedule.
+ *  @param index A pointer to the index to fill in.
+ *  @return bool - TRUE if the schedule is valid.
+ */
+static bool Compile(const TSchedule* const schedule, TScheduleIndex* const index)
+{
+  uint8_t count[SCHEDULE_MAX_PROFILES] = {0};
+  uint8_t nbProfiles = 0;
+
+  if (schedule->magic != SCHEDULE_MAGIC
+      || schedule->nbBands == 0 || schedule->nbBands > SCHEDULE_MAX_BANDS
+      || schedule->nbSeasons == 0 || schedule->nbSeasons > SCHEDULE_MAX_SEASONS
+      || schedule->nbSwitches == 0 || schedule->nbSwitches > SCHEDULE_MAX_SWITCHES
+      || schedule->firstWeekday > 6
+      || schedule->leapYear > 3
+      || schedule->seasonStart[0] != 0)
+    return false;
+
+  for (uint8_t s = 0; s < schedule->nbSeasons; s++)
+  {
+    if (s > 0 && schedule->seasonStart[s] <= schedule->seasonStart[s - 1])
+      return false;
+    if (schedule->seasonStart[s] >= DAYS_PER_YEAR)
+      return false;
+    for (uint8_t dayType = 0; dayType < 2; dayType++)
+    {
+      if (schedule->profiles[s][dayType] >= SCHEDULE_MAX_PROFILES)
+        return false;
+      if (schedule->profiles[s][dayType] >= nbProfiles)
+        nbProfiles = schedule->profiles[s][dayType] + 1;
+    }
+  }
+
+  for (uint8_t i = 0; i < schedule->nbSwitches; i++)
+  {
+    const TScheduleSwitch* sw = &schedule->switches[i];
+
+    if (sw->minute >= 24 * 60 || sw->band >= schedule->nbBands || sw->profile >= nbProfiles)
+      return false;
+    count[sw->profile] ++;
+  }
+
+  // Every profile in use needs at least one switch
+  index->first[0] = 0;
+  for (uint8_t p = 0; p < SCHEDULE_MAX_PROFILES; p++)
+  {
+    if (p < nbProfiles && count[p] == 0)
+      return false;
+    index->first[p + 1] = index->first[p] + count[p];
+  }
+
+  // Insert each switch into its profile's part of the table in order of time
+  for (uint8_t p = 0; p < SCHEDULE_MAX_PROFILES; p++)
+    count[p] = 0;
+  for (uint8_t i = 0; i < schedule->nbSwitches; i++)
+  {
+    const TScheduleSwitch* sw = &schedule->switches[i];
+    TBoundary* base = &index->boundaries[index->first[sw->profile]];
+    uint32_t start = (uint32_t)sw->minute * 60;
+    uint8_t j = count[sw->profile] ++;
+
+    for (; j > 0 && base[j - 1].start > start; j--)
+      base[j] = base[j - 1];
+    // Two bands can not start at the same time
+    if (j > 0 && base[j - 1].start == start)
+      return false;
+    base[j].start = start;
+    base[j].band = sw->band;
+  }
+
+  index->schedule = schedule;
+  return true;
+}
+
+/*! @brief Runs a Flash command that has been set up in the FCCOB registers.
+ *
+ *  @return bool - TRUE if the command completed without errors.
+ */
+static bool LaunchCommand(void)
+{
+  // Clear the error flags from any earlier command, then start this one
+  FTFE_FSTAT = FTFE_FSTAT_ACCERR_MASK | FTFE_FSTAT_FPVIOL_MASK;
+  FTFE_FSTAT = FTFE_FSTAT_CCIF_MASK;
+
+  while (!(FTFE_FSTAT & FTFE_FSTAT_CCIF_MASK))
+  {
+  }
+
+  return !(FTFE_FSTAT & (FTFE_FSTAT_ACCERR_MASK | FTFE_FSTAT_FPVIOL_MASK | FTFE_FSTAT_MGSTAT0_MASK));
+}
+
+/*! @brief Sets the command and address of a Flash command.
+ *
+ *  @param command The Flash command.
+ *  @param address The Flash address.
+ */
+static void SetCommand(const uint8_t command, const uint32_t address)
+{
+  while (!(FTFE_FSTAT & FTFE_FSTAT_CCIF_MASK))
+  {
+  }
+
+  FTFE_FCCOB0 = command;
+  FTFE_FCCOB1 = (uint8_t)(address >> 16);
+  FTFE_FCCOB2 = (uint8_t)(address >> 8);
+  FTFE_FCCOB3 = (uint8_t)address;
+}
+
+/*! @brief Writes a schedule to its Flash sector.
+ *
+ *  @param schedule The schedule.
+ *  @return bool - TRUE if the sector was erased and programmed successfully.
+ */
+static bool WriteFlash(const TSchedule* const schedule)
+{
+  const uint8_t* data = (const uint8_t*)schedule;
+
+  SetCommand(FLASH_CMD_ERASE_SECTOR, SCHEDULE_FLASH_START);
+  if (!LaunchCommand())
+    return false;
+
+  for (uint16_t offset = 0; offset < sizeof(TSchedule); offset += FLASH_PHRASE_SIZE)
+  {
+    const uint8_t* phrase = &data[offset];
+
+    SetCommand(FLASH_CMD_PROGRAM_PHRASE, SCHEDULE_FLASH_START + offset);
+    // Each word of the phrase is loaded most significant byte first
+    FTFE_FCCOB4 = phrase[3];
+    FTFE_FCCOB5 = phrase[2];
+    FTFE_FCCOB6 = phrase[1];
+    FTFE_FCCOB7 = phrase[0];
+    FTFE_FCCOB8 = phrase[7];
+    FTFE_FCCOB9 = phrase[6];
+    FTFE_FCCOBA = phrase[5];
+    FTFE_FCCOBB = phrase[4];
+    if (!LaunchCommand())
+      return false;
+  }
+
+  return true;
+}
+
+/*! @brief Checks the CRC of a schedule.
+ *
+ *  @param schedule The schedule.
+ *  @return bool - TRUE if the CRC matches.
+ */
+static bool CheckCRC(const TSchedule* const schedule)
+{
+  return Crc_16(CRC_16_INIT, schedule, sizeof(TSchedule) - sizeof(schedule->crc)) == schedule->crc;
+}
+
+/*! @brief Loads the schedule stored in Flash, or the default schedule if there is no valid one.
+ *
+ *  @return bool - TRUE if the schedule in Flash was loaded.
+ *  @note Assumes Flash has been initialized.
+ */
+bool Schedule_Init(void)
+{
+  const TSchedule* stored = (const TSchedule*)SCHEDULE_FLASH_START;
+
+  if (CheckCRC(stored) && Compile(stored, &Indexes[0]))
+  {
+    Active = &Indexes[0];
+    return true;
+  }
+
+  (void)Compile(&DefaultSchedule, &Indexes[0]);
+  Active = &Indexes[0];
+  return false;
+}
+
+/*! @brief Gets the day of the year as the seasons count it, in a 365 day year.
+ *
+ *  @param day RTC day.
+ *  @param leapYear Year of the 4 year cycle that is a leap year.
+ *  @return uint16_t day of the year, 29 February counted as 28 February.
+ */
+static uint16_t DayOfYear(const uint32_t day, const uint8_t leapYear)
+{
+  uint16_t dayOfCycle = day % DAYS_PER_CYCLE;
+
+  for (uint8_t year = 0; year < 4; year++)
+  {
+    uint16_t length = (year == leapYear) ? DAYS_PER_YEAR + 1 : DAYS_PER_YEAR;
+
+    if (dayOfCycle < length)
+      return (year == leapYear && dayOfCycle >= LEAP_DAY) ? dayOfCycle - 1 : dayOfCycle;
+    dayOfCycle -= length;
+  }
+  return 0;
+}
+
+/*! @brief Gets the index in force, to be read
+ *
+ *  @param generation A pointer to a memory location to place the generation, for ReadRetired.
+ *  @return const TScheduleIndex* the index.
+ */
+static const TScheduleIndex* ActiveIndex(uint32_t* const generation)
+{
+  *generation = Generation;
+  COMPILER_BARRIER();
+  return Active;
+}
+
+/*! @brief Checks whether the index read, or its schedule, may have been rewritten while it was read
+ *
+ *  Schedule_Commit only rewrites an index and schedule that are not in force, so a reader that
+ *  runs at a higher priority than it never has to read again.
+ *  @param generation Generation from ActiveIndex.
+ *  @return bool - TRUE if what was read has to be read again.
+ */
+static bool ReadRetired(const uint32_t generation)
+{
+  COMPILER_BARRIER();
+  return Generation != generation;
+}
+
+/*! @brief Finds the band in force at a given time in an index.
+ *
+ *  @param index The index.
+ *  @param timeInSeconds RTC time.
+ *  @param secondsLeft A pointer to a memory location to place the number of seconds
+ *                     the band holds for, from timeInSeconds.
+ *  @return uint8_t band.
+ *  @note Only reads inside the index and its schedule even if they are being rewritten.
+ */
+static uint8_t FindInIndex(const TScheduleIndex* const index, const uint32_t timeInSeconds, uint32_t* const secondsLeft)
+{
+  const TSchedule* schedule = index->schedule;
+  uint32_t day = timeInSeconds / SECONDS_PER_DAY;
+  uint32_t secondOfDay = timeInSeconds - day * SECONDS_PER_DAY;
+  uint16_t dayOfYear = DayOfYear(day, schedule->leapYear & 3);
+  uint8_t weekend = ((day + schedule->firstWeekday) % 7) >= 5;
+  uint8_t season = (schedule->nbSeasons - 1) & (SCHEDULE_MAX_SEASONS - 1);
+
+  while (season > 0 && dayOfYear < schedule->seasonStart[season])
+    season --;
+
+  uint8_t profile = schedule->profiles[season][weekend] & (SCHEDULE_MAX_PROFILES - 1);
+  uint8_t begin = index->first[profile];
+  uint8_t end = index->first[profile + 1];
+
+  // Only an index being rewritten can be out of order, and the band found is then discarded
+  if (begin >= end || end > SCHEDULE_MAX_SWITCHES)
+  {
+    begin = 0;
+    end = 1;
+  }
+
+  const TBoundary* first = &index->boundaries[begin];
+  const TBoundary* last = &index->boundaries[end - 1];
+
+  if (secondOfDay < first->start)
+  {
+    // Before the first switch of the day, the last band of the previous day is still in force
+    *secondsLeft = first->start - secondOfDay;
+    return last->band;
+  }
+
+  // Binary search for the last boundary at or before now
+  const TBoundary* low = first;
+  const TBoundary* high = last;
+
+  while (low < high)
+  {
+    const TBoundary* middle = low + (high - low + 1) / 2;
+
+    if (middle->start <= secondOfDay)
+      low = middle;
+    else
+      high = middle - 1;
+  }
+
+  // The last band of the day runs to midnight, where the day profile may change
+  *secondsLeft = ((low < last) ? (low + 1)->start : SECONDS_PER_DAY) - secondOfDay;
+  return low->band;
+}
+
+/*! @brief Finds the band in force at a given time.
+ *
+ *  @param timeInSeconds RTC time.
+ *  @param secondsLeft A pointer to a memory location to place the number of seconds
+ *                     the band holds for, from timeInSeconds.
+ *  @return uint8_t band.
+ */
+uint8_t Schedule_Find(const uint32_t timeInSeconds, uint32_t* const secondsLeft)
+{
+  uint32_t generation;
+  uint8_t band;
+
+  do
+  {
+    band = FindInIndex(ActiveIndex(&generation), timeInSeconds, secondsLeft);
+  } while (ReadRetired(generation));
+
+  return band;
+}
+
+/*! @brief Gets the rate of a band.
+ *
+ *  @param band The band.
+ *  @return uint32_t rate in cents/kWh in 32Q16 format, 0 if the band does not exist.
+ */
+uint32_t Schedule_GetRate(const uint8_t band)
+{
+  uint32_t generation;
+  uint32_t rate;
+
+  do
+  {
+    const TSchedule* schedule = ActiveIndex(&generation)->schedule;
+
+    rate = (band < schedule->nbBands && band < SCHEDULE_MAX_BANDS) ? schedule->rates[band] : 0;
+  } while (ReadRetired(generation));
+
+  return rate;
+}
+
+/*! @brief Gets the number of bands in the schedule.
+ *
+ *  @return uint8_t number of bands.
+ */
+uint8_t Schedule_GetNbBands(void)
+{
+  uint32_t generation;
+  uint8_t nbBands;
+
+  do
+  {
+    nbBands = ActiveIndex(&generation)->schedule->nbBands;
+  } while (ReadRetired(generation));
+
+  return nbBands;
+}
+
+/*! @brief Stores a half word of a new schedule in the upload buffer.
+ *
+ *  @param index Index of the half word in the schedule.
+ *  @param data The half word.
+ *  @return bool - TRUE if the index was in range.
+ */
+bool Schedule_Write(const uint8_t index, const uint16_t data)
+{
+  if (index >= SCHEDULE_NB_HALF_WORDS)
+    return false;
+
+  ((uint16_t*)&UploadBuffer)[index] = data;
+  return true;
+}
+
+/*! @brief Checks the schedule in the upload buffer, writes it to Flash and puts it in force.
+ *
+ *  @return bool - TRUE if the schedule was valid and written to Flash successfully.
+ *  @note An invalid schedule leaves the schedule in force unchanged. A valid one is put
+ *        in force even if writing it to Flash fails, but will not survive a reset.
+ */
+bool Schedule_Commit(void)
+{
+  const TSchedule* stored = (const TSchedule*)SCHEDULE_FLASH_START;
+  uint8_t spare = (Active == &Indexes[0]) ? 1 : 0;
+
+  if (!CheckCRC(&UploadBuffer))
+    return false;
+
+  // The spare index and its copy are not in force, so the meter thread never sees them change.
+  // A lower priority reader may still hold them from before the last commit, and reads again.
+  Generation ++;
+  COMPILER_BARRIER();
+  RAMCopies[spare] = UploadBuffer;
+  if (!Compile(&RAMCopies[spare], &Indexes[spare]))
+    return false;
+
+  // The schedule in force may be the one in Flash, so put the copy in force while the sector is
+  // rewritten, and make anyone still reading the old index read again
+  COMPILER_BARRIER();
+  Active = &Indexes[spare];
+  Generation ++;
+  COMPILER_BARRIER();
+
+  // Read back what was programmed, rather than trusting the buffer
+  if (!WriteFlash(&RAMCopies[spare]) || !CheckCRC(stored) || !Compile(stored, &Indexes[spare ^ 1]))
+    return false;
+
+  COMPILER_BARRIER();
+  Active = &Indexes[spare ^ 1];
+  return true;
+}
+
+/*! @brief Gets a half word of the schedule in force.
+ *
+ *  @param index Index of the half word in the schedule.
+ *  @param data A pointer to a memory location to place the half word.
+ *  @return bool - TRUE if the index was in range.
+ */
+bool Schedule_Read(const uint8_t index, uint16_t* const data)
+{
+  uint32_t generation;
+
+  if (index >= SCHEDULE_NB_HALF_WORDS)
+    return false;
+
+  do
+  {
+    *data = ((const uint16_t*)ActiveIndex(&generation)->schedule)[index];
+  } while (ReadRetired(generation));
+
+  return true;
+}
+
+/*! @brief Gets the CRC of the schedule in force, to verify an upload.
+ *
+ *  @return uint16_t CRC-16 of the schedule up to its crc field.
+ */
+uint16_t Schedule_GetCRC(void)
+{
+  uint32_t generation;
+  uint16_t crc;
+
+  do
+  {
+    crc = Crc_16(CRC_16_INIT, ActiveIndex(&generation)->schedule, sizeof(TSchedule) - sizeof(uint16_t));
+  } while (ReadRetired(generation));
+
+  return crc;
+}
@@ -0,0 +1,124 @@
+/*! @file
+ *
+ *  @brief Time-of-use tariff schedule.
+ *
+ *  This contains the functions for loading a time-of-use schedule from Flash and finding
+ *  the tariff band in force at a given time. A schedule has up to 8 bands, up to 4 seasons
+ *  and different day profiles for weekdays and weekends. It is uploaded over the serial
+ *  port one half word at a time and then committed to Flash.
+ *
+ *  @author Zhengjie Huang
+ *  @date 2017-10-17
+ */
+
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+// new types
+#include "types.h"
+
+#define SCHEDULE_MAX_BANDS    8
+#define SCHEDULE_MAX_SEASONS  4
+#define SCHEDULE_MAX_PROFILES 4
+#define SCHEDULE_MAX_SWITCHES 32
+
+// "TOU1"
+#define SCHEDULE_MAGIC 0x31554F54
+
+/*!
+ * @struct TScheduleSwitch
+ */
+typedef struct
+{
+  uint16_t minute;      /*!< Minute of the day the band starts, 0-1439 */
+  uint8_t band;         /*!< Band in force from then on */
+  uint8_t profile;      /*!< Day profile the switch belongs to */
+} TScheduleSwitch;
+
+/*!
+ * @struct TSchedule
+ * @brief Layout of a schedule in Flash and as uploaded, little endian
+ *
+ * RTC day 0 is 1 January. In a leap year 29 February belongs to the same season as 28 February
+ * and later seasons start on the same dates as in other years. Every fourth year is taken to be a
+ * leap year, so the seasons are one day late from 1 March 2100.
+ */
+typedef struct
+{
+  uint32_t magic;                                   /*!< SCHEDULE_MAGIC */
+  uint8_t nbBands;                                  /*!< 1 to SCHEDULE_MAX_BANDS */
+  uint8_t nbSeasons;                                /*!< 1 to SCHEDULE_MAX_SEASONS */
+  uint8_t nbSwitches;                               /*!< 1 to SCHEDULE_MAX_SWITCHES */
+  uint8_t firstWeekday;                             /*!< Day of the week of RTC day 0, 0 is Monday */
+  uint32_t rates[SCHEDULE_MAX_BANDS];               /*!< cents/kWh of each band, 32Q16 */
+  uint16_t seasonStart[SCHEDULE_MAX_SEASONS];       /*!< First day of each season in a 365 day year, ascending from 0 */
+  uint8_t profiles[SCHEDULE_MAX_SEASONS][2];        /*!< Day profile of each season on weekdays [0] and at weekends [1] */
+  TScheduleSwitch switches[SCHEDULE_MAX_SWITCHES];  /*!< In any order */
+  uint8_t leapYear;                                 /*!< Year of the 4 year cycle that is a leap year, 0-3, 0 is the year of RTC day 0 */
+  uint8_t reserved[5];                              /*!< Pads the schedule to a whole number of Flash phrases */
+  uint16_t crc;                                     /*!< CRC-16 of all the bytes before it */
+} TSchedule;
+
+// Number of half words in a schedule, as indexed by Schedule_Write and Schedule_Read
+#define SCHEDULE_NB_HALF_WORDS (sizeof(TSchedule) / 2)
+
+/*! @brief Loads the schedule stored in Flash, or the default schedule if there is no valid one.
+ *
+ *  @return bool - TRUE if the schedule in Flash was loaded.
+ *  @note Assumes Flash has been initialized.
+ */
+bool Schedule_Init(void);
+
+/*! @brief Finds the band in force at a given time.
+ *
+ *  @param timeInSeconds RTC time.
+ *  @param secondsLeft A pointer to a memory location to place the number of seconds
+ *                     the band holds for, from timeInSeconds.
+ *  @return uint8_t band.
+ */
+uint8_t Schedule_Find(const uint32_t timeInSeconds, uint32_t* const secondsLeft);
+
+/*! @brief Gets the rate of a band.
+ *
+ *  @param band The band.
+ *  @return uint32_t rate in cents/kWh in 32Q16 format, 0 if the band does not exist.
+ */
+uint32_t Schedule_GetRate(const uint8_t band);
+
+/*! @brief Gets the number of bands in the schedule.
+ *
+ *  @return uint8_t number of bands.
+ */
+uint8_t Schedule_GetNbBands(void);
+
+/*! @brief Stores a half word of a new schedule in the upload buffer.
+ *
+ *  @param index Index of the half word in the schedule.
+ *  @param data The half word.
+ *  @return bool - TRUE if the index was in range.
+ */
+bool Schedule_Write(const uint8_t index, const uint16_t data);
+
+/*! @brief Checks the schedule in the upload buffer, writes it to Flash and puts it in force.
+ *
+ *  @return bool - TRUE if the schedule was valid and written to Flash successfully.
+ *  @note An invalid schedule leaves the schedule in force unchanged. A valid one is put
+ *        in force even if writing it to Flash fails, but will not survive a reset.
+ */
+bool Schedule_Commit(void);
+
+/*! @brief Gets a half word of the schedule in force.
+ *
+ *  @param index Index of the half word in the schedule.
+ *  @param data A pointer to a memory location to place the half word.
+ *  @return bool - TRUE if the index was in range.
+ */
+bool Schedule_Read(const uint8_t index, uint16_t* const data);
+
+/*! @brief Gets the CRC of the schedule in force, to verify an upload.
+ *
+ *  @return uint16_t CRC-16 of the schedule up to its crc field.
+ */
+uint16_t Schedule_GetCRC(void);
+
+#endif
@@ -1,29 +1,136 @@
 #include "Tariff.h"
 #include "Flash.h"
 #include "MyRTC.h"
+#include "Math.h"
+#include "OS.h"
+#include "Schedule.h"
+#include "Command.h"
+#include "MyPacket.h"
 
-// 22.235 cents/kWh, left shift 16 bits = 1457192.96
-static uint32_t const PEAK_RATE     = 1457193;
-static uint32_t const SHOULDER_RATE = 288358;
-static uint32_t const OFFPEAK_RATE  = 138215;
+#define CMD_TARIFF          0x11
+#define CMD_SCHEDULE_WRITE  0x21
+#define CMD_SCHEDULE_COMMIT 0x22
+#define CMD_SCHEDULE_VERIFY 0x23
+#define CMD_SCHEDULE_READ   0x24
 
-static uint32_t const TARIFF2_RATE  = 112263;
-static uint32_t const TARIFF3_RATE  = 268698;
+// Flat rates in cents/kWh, 32Q16. Tariff 1 follows the time-of-use schedule
+static TU32Q16 const TARIFF2_RATE  = MATH_Q16(1713, 1000);   // 1.713
+static TU32Q16 const TARIFF3_RATE  = MATH_Q16(4100, 1000);   // 4.100
 
 static TTariff CurrentTariff;
 
+// The register in force from CachedFrom (RTC seconds) for CachedSpan seconds
+static uint8_t CachedRegister;
+static uint32_t CachedFrom;
+static uint32_t CachedSpan;   /*!< 0 when the cache has to be refreshed */
+
+static volatile uint32_t RateVersion;   /*!< Changed every time the register rates may have changed */
+
 bool isSet(uint8_t data)
 {
   return (data == 3 || data == 1 || data == 2);
 }
 
+/*! @brief Sets (parameter 2 = 0) or gets (parameter 2 = 1) the tariff.
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
+ */
+static bool HandleTariff(const TCommandPacket* const packet)
+{
+  // Get Tariff
+  if (packet->parameter2 == 1)
+    return MyPacket_Put(CMD_TARIFF, Tariff_GetMode(), packet->parameter2, packet->parameter3);
+
+  // Tariff range out of scope
+  if (!(packet->parameter1 == 3 || packet->parameter1 == 1 || packet->parameter1 == 2))
+    return false;
+
+  if (packet->parameter2 == 0)
+    return Tariff_Set((uint8_t)packet->parameter1);
+
+  return false;
+}
+
+/*! @brief Stores a half word of a new schedule.
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
+ */
+static bool HandleScheduleWrite(const TCommandPacket* const packet)
+{
+  // Parameter 1 is the index of the half word, parameters 2 and 3 the half word, low byte first
+  uint16union_t data;
+  data.s.Lo = packet->parameter2;
+  data.s.Hi = packet->parameter3;
+
+  return Schedule_Write(packet->parameter1, data.l);
+}
+
+/*! @brief Gets the CRC and number of bands of the schedule in force.
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
+ */
+static bool HandleScheduleVerify(const TCommandPacket* const packet)
+{
+  uint16union_t crc;
+  crc.l = Schedule_GetCRC();
+
+  return MyPacket_Put(CMD_SCHEDULE_VERIFY, crc.s.Lo, crc.s.Hi, Schedule_GetNbBands());
+}
+
+/*! @brief Commits the uploaded schedule.
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
+ */
+static bool HandleScheduleCommit(const TCommandPacket* const packet)
+{
+  bool committed = Schedule_Commit();
+  uint16union_t crc;
+
+  // The schedule in force may have changed even if writing it to Flash failed
+  Tariff_Refresh();
+
+  // Reply with the CRC of the schedule now in force and whether it was stored
+  crc.l = Schedule_GetCRC();
+  return MyPacket_Put(CMD_SCHEDULE_COMMIT, crc.s.Lo, crc.s.Hi, committed);
+}
+
+/*! @brief Gets a half word of the schedule in force.
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
+ */
+static bool HandleScheduleRead(const TCommandPacket* const packet)
+{
+  uint16union_t data;
+
+  if (!Schedule_Read(packet->parameter1, &data.l))
+    return false;
+
+  return MyPacket_Put(CMD_SCHEDULE_READ, packet->parameter1, data.s.Lo, data.s.Hi);
+}
+
 /*! @brief Initialize the Tariff module before first use
  *
  *  @return bool - true if Tariff is initialized successfully
  */
 bool Tariff_Init()
 {
-  if (Flash_Init())
+  bool flashReady = Flash_Init();
+
+  // Falls back to the built in schedule if there is no valid one in Flash
+  (void)Schedule_Init();
+
+  (void)Command_Register(CMD_TARIFF, HandleTariff);
+  (void)Command_Register(CMD_SCHEDULE_WRITE, HandleScheduleWrite);
+  (void)Command_Register(CMD_SCHEDULE_COMMIT, HandleScheduleCommit);
+  (void)Command_Register(CMD_SCHEDULE_VERIFY, HandleScheduleVerify);
+  (void)Command_Register(CMD_SCHEDULE_READ, HandleScheduleRead);
+
+  if (flashReady)
   {
     uint8_t data = (uint8_t)(_FB(FLASH_DATA_START));
     if (!isSet(data))
@@ -52,13 +159,36 @@ bool Tariff_Set(uint8_t nb)
 
   if (Flash_Write8((uint8_t*)FLASH_DATA_START, nb))
   {
+    OS_DisableInterrupts();
     CurrentTariff = (TTariff)nb;
+    CachedSpan = 0;
+    OS_EnableInterrupts();
     return true;
   }
 
   return false;
 }
 
+/*! @brief Make the next Tariff_GetRegister look the register up again, after the schedule has changed
+ *
+ */
+void Tariff_Refresh()
+{
+  OS_DisableInterrupts();
+  CachedSpan = 0;
+  RateVersion ++;
+  OS_EnableInterrupts();
+}
+
+/*! @brief Get a number that changes whenever the rates of the registers may have changed
+ *
+ *  @return uint32_t Version of the rates
+ */
+uint32_t Tariff_GetRateVersion()
+{
+  return RateVersion;
+}
+
 /*! @brief Get mode of Tariff
  *
  *  @return uint_8 mode of Tariff
@@ -68,29 +198,65 @@ uint8_t Tariff_GetMode()
   return (uint8_t)CurrentTariff;
 }
 
-/*! @brief Get rate for now
+/*! @brief Work out the energy register in force at a given time and how long it stays in force
  *
- *  @return uint32_t Rate of current time in 32Q16 format
+ *  @param timeInSeconds RTC time
+ *  @param secondsLeft A pointer to a memory location to place the number of seconds
+ *                     the register holds for, from timeInSeconds
+ *  @return uint8_t Energy register at that time
  */
-uint32_t Tariff_GetRate()
+static uint8_t FindRegister(const uint32_t timeInSeconds, uint32_t* const secondsLeft)
 {
-  uint8_t day, hour, minute, second;
+  // Flat rates never change
+  *secondsLeft = UINT32_MAX;
+
   switch (CurrentTariff)
   {
     case TARIFF_1:
-      MyRTC_Get(&day, &hour, &minute, &second);
-      if (hour < 7 || hour >= 22)
-        return OFFPEAK_RATE;
-      else if (hour < 14 || hour >= 20)
-        return SHOULDER_RATE;
-      else
-        return PEAK_RATE;
+      // Registers 0 to SCHEDULE_MAX_BANDS - 1 are the bands of the schedule
+      return Schedule_Find(timeInSeconds, secondsLeft);
     case TARIFF_2:
+      return TARIFF_REGISTER_FLAT2;
+    default:
+      // Unknown tariffs are charged at the tariff 3 rate rather than lost
+      return TARIFF_REGISTER_FLAT3;
+  }
+}
+
+/*! @brief Get the energy register for now
+ *
+ *  @return uint8_t Register that energy used now is to be added to, below TARIFF_NB_REGISTERS
+ */
+uint8_t Tariff_GetRegister()
+{
+  uint32_t now = MyRTC_GetTimeInSeconds();
+
+  // Unsigned subtraction also catches the clock being set back before the cached interval
+  if (now - CachedFrom >= CachedSpan)
+  {
+    OS_DisableInterrupts();
+    CachedRegister = FindRegister(now, &CachedSpan);
+    CachedFrom = now;
+    OS_EnableInterrupts();
+  }
+
+  return CachedRegister;
+}
+
+/*! @brief Get the rate of an energy register
+ *
+ *  @param reg The register
+ *  @return uint32_t Rate in cents/kWh in 32Q16 format
+ */
+uint32_t Tariff_GetRegisterRate(const uint8_t reg)
+{
+  switch (reg)
+  {
+    case TARIFF_REGISTER_FLAT2:
       return TARIFF2_RATE;
-    case TARIFF_3:
+    case TARIFF_REGISTER_FLAT3:
       return TARIFF3_RATE;
     default:
-      // Something went wrong
-      return 0;
+      return Schedule_GetRate(reg);
   }
 }
@@ -2,6 +2,12 @@
 #define TARIFF_H
 
 #include "types.h"
+#include "Schedule.h"
+
+// Energy is accumulated in one register per time-of-use band, plus one for each flat tariff
+#define TARIFF_REGISTER_FLAT2 SCHEDULE_MAX_BANDS
+#define TARIFF_REGISTER_FLAT3 (SCHEDULE_MAX_BANDS + 1)
+#define TARIFF_NB_REGISTERS   (SCHEDULE_MAX_BANDS + 2)
 
 typedef enum{
   TARIFF_NULL,
@@ -23,19 +29,35 @@ bool Tariff_Init(void);
  */
 bool Tariff_Set(uint8_t nb);
 
+/*! @brief Make the next Tariff_GetRegister look the register up again, after the schedule has changed
+ *
+ */
+void Tariff_Refresh(void);
+
+/*! @brief Get a number that changes whenever the rates of the registers may have changed
+ *
+ *  @return uint32_t Version of the rates
+ */
+uint32_t Tariff_GetRateVersion(void);
+
 /*! @brief Get mode of Tariff
  *
  *  @return uint_8 mode of Tariff
  */
 uint8_t Tariff_GetMode(void);
 
-/*! @brief Get rate for now
+/*! @brief Get the energy register for now
  *
- *  @return uint32_t Rate of current time in 32Q16 format
+ *  @return uint8_t Register that energy used now is to be added to, below TARIFF_NB_REGISTERS
  */
-uint32_t Tariff_GetRate(void);
-
+uint8_t Tariff_GetRegister(void);
 
-#endif
+/*! @brief Get the rate of an energy register
+ *
+ *  @param reg The register
+ *  @return uint32_t Rate in cents/kWh in 32Q16 format
+ */
+uint32_t Tariff_GetRegisterRate(const uint8_t reg);
 
 
+#endif
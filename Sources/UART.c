@@ -11,7 +11,6 @@
 #include "types.h"
 #include "Cpu.h"
 #include "FIFO.h"
-#include "LEDs.h"
 #include "UART.h"
 
 #define TDRE                      UART_S1_TDRE_MASK
@@ -21,50 +20,33 @@
 #define SIM_SCGC5_PORTE           SIM_SCGC5_PORTE_MASK
 #define TOWER_NUMBER 0x9285
 #define TOWER_VERSION 1
-#define THREAD_STACK_SIZE 100
 
-typedef struct CommThreadData
-{
-  OS_ECB* semaphore;
-}TCommThreadData;
-
-OS_THREAD_STACK(RxThreadStack, THREAD_STACK_SIZE); /*!< The stack for the Serial communication thread. */
-OS_THREAD_STACK(TxThreadStack, THREAD_STACK_SIZE); /*!< The stack for the Serial communication thread. */
-
-uint8_t TempData;
-
-static TCommThreadData RxThreadData =
-{
-  .semaphore = NULL,
-};
-static TCommThreadData TxThreadData =
-{
-  .semaphore = NULL,
-};
+// eDMA channel and DMAMUX request source that move the transmit FIFO to UART2_D
+#define TX_DMA_CHANNEL 0
+#define TX_DMA_SOURCE  7
 
 static TFIFO RxFIFO, TxFIFO;
 
-static void RxThread(void* pData)
-{
-  for (;;)
-  {
-    if (RxThreadData.semaphore)
-      (void)OS_SemaphoreWait(RxThreadData.semaphore, 0);
-
-    FIFO_Put(&RxFIFO, TempData);
-  }
-}
+static uint16_t volatile TxLength;   /*!< Bytes being moved by the DMA, 0 when it is idle */
 
-static void TxThread(void* pData)
+/*! @brief Starts the DMA on the oldest bytes in the transmit FIFO, if there are any.
+ *
+ *  @note Must be called with interrupts disabled or from the DMA ISR.
+ */
+static void StartTransmit(void)
 {
-  for (;;)
-  {
-    if (TxThreadData.semaphore)
-      (void)OS_SemaphoreWait(TxThreadData.semaphore, 0);
-
-    FIFO_Get(&TxFIFO, (uint8_t *)&UART2_D);
-    UART2_C2 |= UART_C2_TIE_MASK;
-  }
+  const uint8_t* data;
+  uint16_t length = FIFO_Peek(&TxFIFO, &data);
+
+  TxLength = length;
+  if (length == 0)
+    return;
+
+  DMA_TCD0_SADDR = (uint32_t)data;
+  DMA_TCD0_CITER_ELINKNO = DMA_CITER_ELINKNO_CITER(length);
+  DMA_TCD0_BITER_ELINKNO = DMA_BITER_ELINKNO_BITER(length);
+  DMA_TCD0_CSR = DMA_CSR_INTMAJOR_MASK | DMA_CSR_DREQ_MASK;
+  DMA_SERQ = DMA_SERQ_SERQ(TX_DMA_CHANNEL);
 }
 
 
@@ -78,12 +60,12 @@ bool UART_Init(const uint32_t baudRate, const uint32_t moduleClk)
 {
   int16union_t SBR;
   uint16_t brfa;
-  OS_ERROR error;
   SBR.l = moduleClk / baudRate / 0x10;
   brfa = (uint16_t)(moduleClk*2/baudRate)%32;
 
-  TxThreadData.semaphore = OS_SemaphoreCreate(1);
-  RxThreadData.semaphore = OS_SemaphoreCreate(0);
+  /* enable DMA and DMAMUX Clock gates */
+  SIM_SCGC6 |= SIM_SCGC6_DMAMUX0_MASK;
+  SIM_SCGC7 |= SIM_SCGC7_DMA_MASK;
 
   /* enable UART2 Clock gate */
   SIM_SCGC4 |= SIM_SCGC4_UART2_CLOCK;
@@ -105,9 +87,26 @@ bool UART_Init(const uint32_t baudRate, const uint32_t moduleClk)
   UART2_C4 = (brfa&0x1f);
 
   // Enable Packet Receive Interrupt
-  UART2_C2 &= ~UART_C2_TIE_MASK;
   UART2_C2 |= UART_C2_RIE_MASK;
 
+  // The transmitter requests a DMA transfer instead of an interrupt whenever it is empty;
+  // the DMA channel is only enabled while there is something to send
+  UART2_C5 |= UART_C5_TDMAS_MASK;
+  UART2_C2 |= UART_C2_TIE_MASK;
+
+  // One byte per request from the FIFO to the data register, the source address and count are set per transfer
+  DMAMUX0_CHCFG0 = 0;
+  DMA_CERQ = DMA_CERQ_CERQ(TX_DMA_CHANNEL);
+  DMA_TCD0_SOFF = 1;
+  DMA_TCD0_ATTR = DMA_ATTR_SSIZE(0) | DMA_ATTR_DSIZE(0);
+  DMA_TCD0_NBYTES_MLNO = DMA_NBYTES_MLNO_NBYTES(1);
+  DMA_TCD0_SLAST = 0;
+  DMA_TCD0_DADDR = (uint32_t)&UART2_D;
+  DMA_TCD0_DOFF = 0;
+  DMA_TCD0_DLASTSGA = 0;
+  DMAMUX0_CHCFG0 = DMAMUX_CHCFG_ENBL_MASK | DMAMUX_CHCFG_SOURCE(TX_DMA_SOURCE);
+  TxLength = 0;
+
   // Initialize NVIC
   // Vector 65, IRQ=49
   // NVIC non-IPR=1 IPR=12
@@ -116,25 +115,15 @@ bool UART_Init(const uint32_t baudRate, const uint32_t moduleClk)
   // Enable interrupts from PIT module
   NVICISER1 = (1 << 17);
 
+  // Vector 16, IRQ=0 for the end of a transmit DMA transfer
+  NVICICPR0 = (1 << 0);
+  NVICISER0 = (1 << 0);
+
   /* initialize RxFIFO */
   FIFO_Init(&RxFIFO);
   /* initialize TxFIFO */
   FIFO_Init(&TxFIFO);
 
-  error = OS_ThreadCreate(TxThread,
-                          &TxThreadData,
-                          &TxThreadStack[THREAD_STACK_SIZE - 1],
-                          7);
-  if (error != 0)
-        LEDs_On(LED_ORANGE);
-
-  error = OS_ThreadCreate(RxThread,
-                          &RxThreadData,
-                          &RxThreadStack[THREAD_STACK_SIZE - 1],
-                          1);
-  if (error != 0)
-        LEDs_On(LED_ORANGE);
-
   return true;
 }
 
@@ -157,7 +146,39 @@ bool UART_InChar(uint8_t * const dataPtr)
  */
 bool UART_OutChar(const uint8_t data)
 {
-  return (FIFO_Put(&TxFIFO, data));
+  if (!FIFO_Put(&TxFIFO, data))
+    return false;
+
+  // Otherwise the DMA ISR picks the byte up when the transfer in progress ends
+  OS_DisableInterrupts();
+  if (TxLength == 0)
+    StartTransmit();
+  OS_EnableInterrupts();
+  return true;
+}
+
+/*! @brief Put a block of bytes in the transmit FIFO, waiting for space if it is full.
+ *
+ *  @param data A pointer to the bytes to be placed in the transmit FIFO.
+ *  @param length Number of bytes.
+ *  @return bool - true if all the bytes were placed in the transmit FIFO.
+ *  @note Assumes that UART_Init has been called.
+ */
+bool UART_OutBlock(const uint8_t* const data, const uint16_t length)
+{
+  uint16_t sent = 0;
+
+  while (sent < length)
+  {
+    sent += FIFO_PutBlock(&TxFIFO, &data[sent], length - sent);
+
+    // Start the DMA as soon as there is something to send, rather than after the whole block
+    OS_DisableInterrupts();
+    if (TxLength == 0)
+      StartTransmit();
+    OS_EnableInterrupts();
+  }
+  return true;
 }
 
 /*! @brief Poll the UART status register to try and receive and/or transmit one character.
@@ -173,32 +194,38 @@ void UART_Poll(void)
 
 /*! @brief Interrupt service routine for the UART.
  *
+ *  Moves received bytes from the data register to the receive FIFO for as long as the
+ *  UART has bytes to give. Transmission is done by the DMA.
  *  @note Assumes the transmit and receive FIFOs have been initialized.
  */
 void __attribute__ ((interrupt)) UART_ISR(void)
 {
+  OS_ISREnter();
+
   if (UART2_C2 & UART_C2_RIE_MASK)
   {
-    if (UART2_S1 & UART_S1_RDRF_MASK)
-    {
-      // Read UART2_D to clear interrupt flag
-      TempData = UART2_D;
-      OS_SemaphoreSignal(RxThreadData.semaphore);
-    }
+    // Reading UART2_D clears the flag. A byte that finds the FIFO full is lost
+    while (UART2_S1 & UART_S1_RDRF_MASK)
+      (void)FIFO_TryPut(&RxFIFO, UART2_D);
   }
 
-  if (UART2_C2 & UART_C2_TIE_MASK)
-  {
-    if (UART2_S1 & UART_S1_TDRE_MASK)
-    {
-      OS_SemaphoreSignal(TxThreadData.semaphore);
-      UART2_C2 &= ~UART_C2_TIE_MASK;
-    }
-  }
+  OS_ISRExit();
 }
 
+/*! @brief Interrupt service routine for the end of a transmit DMA transfer.
+ *
+ *  Removes the bytes sent from the transmit FIFO, waking up a thread waiting for space,
+ *  and starts a transfer of whatever has been put in the FIFO since.
+ */
+void __attribute__ ((interrupt)) UART_TxDMAISR(void)
+{
+  OS_ISREnter();
 
+  DMA_CINT = DMA_CINT_CINT(TX_DMA_CHANNEL);
+  DMA_CDNE = DMA_CDNE_CDNE(TX_DMA_CHANNEL);
 
+  FIFO_Discard(&TxFIFO, TxLength);
+  StartTransmit();
 
-
-
+  OS_ISRExit();
+}
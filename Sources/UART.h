@@ -40,12 +40,30 @@ bool UART_InChar(uint8_t* const dataPtr);
  */
 bool UART_OutChar(const uint8_t data);
 
+/*! @brief Put a block of bytes in the transmit FIFO, waiting for space if it is full.
+ *
+ *  @param data A pointer to the bytes to be placed in the transmit FIFO.
+ *  @param length Number of bytes.
+ *  @return bool - true if all the bytes were placed in the transmit FIFO.
+ *  @note Assumes that UART_Init has been called.
+ */
+bool UART_OutBlock(const uint8_t* const data, const uint16_t length);
+
 void UART_SendData(void);
 
 /*! @brief Interrupt service routine for the UART.
  *
+ *  Moves received bytes from the data register to the receive FIFO for as long as the
+ *  UART has bytes to give. Transmission is done by the DMA.
  *  @note Assumes the transmit and receive FIFOs have been initialized.
  */
 void __attribute__ ((interrupt)) UART_ISR(void);
 
+/*! @brief Interrupt service routine for the end of a transmit DMA transfer.
+ *
+ *  Removes the bytes sent from the transmit FIFO, waking up a thread waiting for space,
+ *  and starts a transfer of whatever has been put in the FIFO since.
+ */
+void __attribute__ ((interrupt)) UART_TxDMAISR(void);
+
 #endif
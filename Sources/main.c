@@ -39,6 +39,9 @@
 #include "OS.h"
 #include "meter.h"
 #include "DAC.h"
+#include "Bench.h"
+#include "Command.h"
+#include "Capture.h"
 
 // Analog functions
 #include "analog.h"
@@ -59,21 +62,25 @@ OS_THREAD_STACK(InitModulesThreadStack, THREAD_STACK_SIZE); /*!< The stack for t
  *
  *  Several threads will be created.
  *  main.c:      InitModulesThread 0
- *  meter.c:     VoltageThread     3
- *               CurrentThread     4
- *               CalcThread        8
- *  UART.c:      TxThread          7
- *               RxThread          1
+ *  meter.c:     MeterThread       3
  *  DAC.c:       OutputThread      2
  *  Protocol.c:  ProtocolThread    5
+ *               TelemetryThread   4
  *  Interface.c: PushButtonThread  6
  *               DisplayThread     9
+ *  Display.c:   ConsoleThread     10
  *
  */
 static void InitModulesThread(void* pData)
 {
   OS_DisableInterrupts();
 
+  // Every other module registers its commands when it is initialized
+  (void)Command_Init();
+
+  // Start the cycle counter used for timing measurements
+  (void)Bench_Init();
+
   // Initialize analog module
   (void)Analog_Init(CPU_BUS_CLK_HZ);
 
@@ -81,9 +88,10 @@ static void InitModulesThread(void* pData)
 
   Tariff_Init();
   Meter_Init(MODULE_CLK);
+  Capture_Init(SAMPLES_PER_CYCLE);
   FTM_Init();
   DAC_Init();
-  Interface_Init();
+  (void)Interface_Init();
   LEDs_Init();
   Protocol_Init();
   OS_EnableInterrupts();
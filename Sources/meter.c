@@ -7,266 +7,684 @@
 #include "PIT.h"
 #include "Math.h"
 #include "Tariff.h"
-#include "SampleQueue.h"
-
-#define SAMPLE_PERIOD_BASE 1187350 // 52.5 Hz
+#include "Kernel.h"
+#include "PLL.h"
+#include "Frequency.h"
+#include "Bench.h"
+#include "Capture.h"
+#include "Command.h"
+
+#define SAMPLE_PERIOD_MIN  (NANO_SECONDS_IN_A_SECOND / (55 * SAMPLES_PER_CYCLE)) // 55 Hz
+#define SAMPLE_PERIOD_MAX  (NANO_SECONDS_IN_A_SECOND / (45 * SAMPLES_PER_CYCLE)) // 45 Hz
 #define NB_ANALOG_CHANNELS 2
+#define NB_SAMPLE_BLOCKS   2       // Ping-pong buffers
 
 #define VOLTAGE_CHANNEL 1
 #define CURRENT_CHANNEL 2
 
-#define VOLTAGE_THREAD 0
-#define CURRENT_THREAD 1
+#define VOLTAGE_INDEX 0
+#define CURRENT_INDEX 1
+
+// Stops the compiler moving the copy of a record across a read or update of RecordsPublished
+#define COMPILER_BARRIER() __asm__ volatile ("" ::: "memory")
+
+// Define METER_NEWTON_SQRT to build the iterative square root for comparison.
+// Newton iterations used to refine last cycle's RMS value
+#define RMS_ITERATIONS 2
 
 #define THREAD_STACK_SIZE 300
 
-/*! @brief Data structure used to pass Analog configuration to a user thread
+#define CMD_POWER         0x14
+#define CMD_ENERGY        0x15
+#define CMD_COST          0x16
+#define CMD_FREQUENCY     0x17
+#define CMD_VOLTAGE_RMS   0x18
+#define CMD_CURRENT_RMS   0x19
+#define CMD_POWER_FACTOR  0x1A
+#define CMD_FREQUENCY_MHZ 0x20
+#define CMD_BAND          0x25
+
+static const TReciprocal PerThousand = MATH_RECIPROCAL(1000, 41);
+static const TReciprocal PerKWh      = MATH_RECIPROCAL(JOULES_PER_KWH, 53);
+static const TReciprocal PerHour     = MATH_RECIPROCAL(3600, 43);
+
+/*! @brief Data structure used to hold the processing state of one analog channel
  *
  */
-typedef struct AnalogThreadData
+typedef struct AnalogChannelData
 {
-  OS_ECB* semaphore;
-  OS_ECB* signal;   // Semaphore to be signaled
   uint8_t channelNb;
   uint16_t* RMS;
   uint8_t  ratio;   // ratio from output to ADC to raw input
-  SampleQueue queue;
-} TAnalogThreadData;
-
-OS_THREAD_STACK(CalcThreadStack, THREAD_STACK_SIZE); /*!< The stack for the Calc thread. */
-static uint32_t AnalogThreadStacks[NB_ANALOG_CHANNELS][THREAD_STACK_SIZE] __attribute__ ((aligned(0x08)));
-
-uint32_t TickPeriod = SAMPLE_PERIOD_BASE;
-uint8_t FrequencyDiff = 25;
-
-int16_t Meter_Voltage;       /*!< In 16Q8 format */
-int16_t Meter_Current;
+  bool firstTime;   // No RMS value to refine yet
+} TAnalogChannelData;
 
-uint16_t Meter_VoltageRMS;   /*!< In 16Q8 format */
-uint16_t Meter_CurrentRMS;
-
-int16_t InstantaneousVoltage;/*!< In 16Q8 format */
-int16_t InstantaneousCurrent;
-
-uint32_t Meter_AveragePower;  /*!< Unit: kW.     P=VIcos, calculated every sample time        */
-uint64_t Meter_Energy;        /*!< Unit: Joule.  E=sum(p)*Ts, calculated every period         */
-uint64_t Meter_Cost;          /*!< Unit: Cent.   Cost of electricity, calculated every period */
-uint16_t Meter_PowerFactor;   /*!< 16Q8, from 0 to 1                                        */
+/*! @brief One mains cycle of voltage and current samples
+ *
+ */
+typedef struct
+{
+  int16_t voltage[SAMPLES_PER_CYCLE];   /*!< In 16Q8 format */
+  int16_t current[SAMPLES_PER_CYCLE];
+  uint32_t time;                        /*!< Time of the first sample in PIT clock ticks */
+} TSampleBlock;
+
+OS_THREAD_STACK(MeterThreadStack, THREAD_STACK_SIZE); /*!< The stack for the Meter thread. */
+
+static TPLL MeterPLL;            /*!< Locks the sample period to the voltage */
+static uint32_t NsPerTick;       /*!< Length of a PIT clock tick */
+static uint32_t LoadedTicks;     /*!< Period to be used after the next reload */
+static uint32_t RunningTicks;    /*!< Period running since the last sample */
+static uint32_t SampleTime;      /*!< Time of the latest sample in PIT clock ticks */
+
+/*!
+ * @struct TBandRegister
+ * @brief Energy and cost of one tariff band
+ */
+typedef struct
+{
+  uint64_t energy;     /*!< 64Q32 Joule used in the band */
+  uint64_t unpriced;   /*!< 64Q32 Joule used since the rate last changed */
+  uint64_t charged;    /*!< 64Q32 cents for the energy used before then */
+  uint32_t rate;       /*!< 32Q16 cents/kWh the unpriced energy is charged at */
+} TBandRegister;
+
+static TBandRegister Bands[TARIFF_NB_REGISTERS];
+static uint32_t RateVersion;     /*!< Version of the tariff rates in Bands */
+
+// Written by the meter thread only, and read by others through the published records
+static uint16_t VoltageRMS;    /*!< In 16Q8 format */
+static uint16_t CurrentRMS;
+static uint32_t AveragePower;  /*!< Unit: kW.     P=VIcos, calculated every cycle              */
+static uint64_t Energy;        /*!< Unit: Joule.  E=sum(p)*Ts, calculated every cycle          */
+static uint16_t PowerFactor;   /*!< 16Q8, from 0 to 1                                         */
+
+uint32_t Meter_BlockOverruns; /*!< Number of blocks dropped because the meter thread fell behind */
 uint8_t Phase;
-// ----------------------------------------
-// Thread priorities
-// 0 = highest priority
-// ----------------------------------------
-const uint8_t ANALOG_THREAD_PRIORITIES[NB_ANALOG_CHANNELS] = {3, 4};
 
-/*! @brief Analog thread configuration data
+/*! @brief Analog channel configuration data
  *
  */
-static TAnalogThreadData AnalogThreadData[NB_ANALOG_CHANNELS] =
+static TAnalogChannelData AnalogChannelData[NB_ANALOG_CHANNELS] =
 {
   {
-    .semaphore = NULL,
     .channelNb = VOLTAGE_CHANNEL,
-    .RMS = &Meter_VoltageRMS,
-    .ratio = 100,
-    .signal = NULL
+    .RMS = &VoltageRMS,
+    .ratio = 100
   },
   {
-    .semaphore = NULL,
     .channelNb = CURRENT_CHANNEL,
-    .RMS = &Meter_CurrentRMS,
-    .ratio = 1,
-    .signal = NULL
+    .RMS = &CurrentRMS,
+    .ratio = 1
   }
 };
 
-/*! @brief Semaphore for calculation thread
+/*! @brief Ping-pong sample buffers, block n is filled into SampleBlocks[n % NB_SAMPLE_BLOCKS]
+ *
+ */
+static TSampleBlock SampleBlocks[NB_SAMPLE_BLOCKS] __attribute__ ((aligned(0x04)));
+static uint8_t FillIndex;                  /*!< Buffer being filled by the PIT ISR */
+static uint8_t FillCount;                  /*!< Samples in the buffer being filled */
+static volatile uint32_t BlocksFilled;     /*!< Written by the PIT ISR only */
+static uint32_t BlocksProcessed;           /*!< Written by the meter thread only */
+
+/*! @brief Semaphore for meter thread, signaled once per full block
  *
  */
-static OS_ECB* CalcSemaphore;
+static OS_ECB* BlockSemaphore;
+
+static uint16_t TelemetryPeriod;           /*!< Cycles between telemetry records, 0 when off */
+static uint16_t TelemetryCountdown;        /*!< Cycles left until the next record is due */
+static OS_ECB* TelemetrySemaphore;         /*!< Signaled when a record is due */
+
+/*!
+ * @struct TMeterRecord
+ * @brief Measurements of one cycle as published to other threads
+ */
+typedef struct
+{
+  TMeterSnapshot snapshot;                   /*!< cost is left at 0, readers price the bands */
+  TBandRegister bands[TARIFF_NB_REGISTERS];
+} TMeterRecord;
+
+// The meter thread fills Records[(RecordsPublished + 1) % 2] while readers copy Records[RecordsPublished % 2]
+static TMeterRecord Records[2];
+static volatile uint32_t RecordsPublished;
 
 
-/*! @brief Get the frequency difference between current voltage frequency and nominal frequency(50 Hz)
+/*! @brief Update the RMS value of a channel from one cycle's sum of squares
  *
- *  @return 0-50
+ *  @param analogData Channel to be updated.
+ *  @param sumOfSquares Sum of the squared samples over the cycle, of base 100/(2^30)
  */
-uint8_t Meter_GetFrequencyDiff()
+static void MeterRMS(TAnalogChannelData* const analogData, const int64_t sumOfSquares)
 {
-  return FrequencyDiff;
+  // Samples are converted to 32Q16 by *2*10, so their squares are of base 400/(2^16) in 64Q32.
+  // Dividing by the number of samples gives the mean square in 32Q16.
+  // The maximum mean square is 655360 * 655360 >> 16 = 6553600, which fits in 32 bits
+  uint32_t meanSquare = (uint32_t)(((uint64_t)sumOfSquares * 400) >> (16 + SAMPLES_PER_CYCLE_SHIFT));
+
+  uint32_t start = Bench_Start();
+
+#ifdef METER_NEWTON_SQRT
+  if (analogData->firstTime)
+  {
+    // Calculate RMS for the first time
+    *analogData->RMS = Math_SquareRoot(0, meanSquare, 0) * analogData->ratio;
+    analogData->firstTime = false;
+  }
+  else
+  {
+    // Refine last cycle's value. Since Voltage RMS is no more than 250V, no overflow
+    *analogData->RMS = (Math_SquareRoot(*analogData->RMS/(analogData->ratio), meanSquare, RMS_ITERATIONS)) * analogData->ratio;
+  }
+#else
+  // The root of a 32Q16 value is in 16Q8. Since Voltage RMS is no more than 250V, no overflow
+  *analogData->RMS = Math_ISqrt32(meanSquare) * analogData->ratio;
+#endif
+
+  Bench_Stop(BENCH_METER_SQRT, start);
+}
+
+/*! @brief Price the energy of a tariff band
+ *
+ *  @param band A pointer to the band register
+ *  @return uint64_t cost in cents, 64Q32
+ */
+static uint64_t BandCost(const TBandRegister* const band)
+{
+  // 64Q32 Joule to 64Q32 kWh, times 32Q16 cents/kWh
+  return band->charged + Math_MulQ16Wide(Math_RecipMul(band->unpriced, PerKWh), band->rate);
 }
 
-/*! @brief Measure the frequency of voltage's sine wave
+/*! @brief Charges the energy used so far at the old rates when the rates change
  *
- *  @param analogInputValue The latest voltage value
+ *  Past energy is never priced at a later rate, so a new schedule can not change the cost
+ *  already used, even if it drops bands.
  */
-void MeterFrequency(int16_t analogInputValue)
+static void UpdateRates(void)
 {
-  static bool started = false; // Start from the first zero crossing
-  static int16_t previousVoltage = 0;
-  static uint8_t tickCnt = 0;
+  uint32_t version = Tariff_GetRateVersion();
+
+  if (version == RateVersion)
+    return;
 
-  if (previousVoltage * analogInputValue < 0 && started)
+  RateVersion = version;
+  for (uint8_t reg = 0; reg < TARIFF_NB_REGISTERS; reg++)
   {
-    // half a cycle
-    if (tickCnt > 7)
-    // Sample frequency too fast
-    {
-      TickPeriod = SAMPLE_PERIOD_BASE + SAMPLE_TIME_INCREMENT*(++FrequencyDiff);
-      PIT_Enable(false);
-      PIT_Set(TickPeriod, true);
-      started = false;
-      previousVoltage = 0;
-    }
-    else if (tickCnt < 7)
-    // Sample frequency too slow
-    {
-      TickPeriod = SAMPLE_PERIOD_BASE + SAMPLE_TIME_INCREMENT*(--FrequencyDiff);
-      PIT_Enable(false);
-      PIT_Set(TickPeriod, true);
-      started = false;
-      previousVoltage = 0;
-    }
-    tickCnt = 0;
+    Bands[reg].charged = BandCost(&Bands[reg]);
+    Bands[reg].unpriced = 0;
+    Bands[reg].rate = Tariff_GetRegisterRate(reg);
   }
-  else if (!started)
-  // Found the first zero crossing place
+}
+
+/*! @brief Calculate power, energy and power factor of one cycle
+ *
+ *  @param sumOfProducts Sum of V*I over the cycle, of base 100/(2^30)
+ */
+static void MeterCycle(const int64_t sumOfProducts)
+{
+  // Convert from base 100/(2^30) to 32Q16(1/2^16)
+  // 100/(2^30) * (2^16) = 25/4096
+  T32Q16 sumOfPower = Math_SatS32(Math_ShiftRound(sumOfProducts * 25, 12));
+
+  // Handle situations when Voltage's frequency and Current's frequency don't match
+  if (sumOfPower < 0)
   {
-    if (previousVoltage * analogInputValue < 0)
-      started = true;
+    sumOfPower = 0;
   }
+  // 32Q16 * 32Q16 = 64Q32, 100 is the ratio of raw to output
+  TU64Q32 energyForOnePeriod = Math_MulWideU((uint32_t)sumOfPower, Protocol_GetTime(100));
+  Energy += energyForOnePeriod;
+  // Cost is worked out from the band registers when it is read
+  UpdateRates();
+  TBandRegister* const band = &Bands[Tariff_GetRegister()];
+  band->energy += energyForOnePeriod;
+  band->unpriced += energyForOnePeriod;
+
+  // Average over the cycle, *100 for the ratio of raw to output
+  TU32Q16 watts = Math_SatU32(Math_MulWideU((uint32_t)sumOfPower >> SAMPLES_PER_CYCLE_SHIFT, 100));
+  // W to kW
+  AveragePower = (uint32_t)Math_RecipMul(watts, PerThousand);
+
+  // P / (Vrms * Irms). 16Q8 * 16Q8 = 32Q16 VA, 32Q16 / 32Q16 * 2^8 = 16Q8.
+  // Shift the power up as far as it goes and the apparent power down by the rest,
+  // so the division fits the 32-bit hardware divide
+  TU32Q16 voltAmps = (uint32_t)VoltageRMS * CurrentRMS;
+  uint8_t shift = (watts == 0) ? 8 : (uint8_t)__builtin_clz(watts);
+
+  if (shift > 8)
+    shift = 8;
+  voltAmps >>= 8 - shift;
+  if (voltAmps == 0)
+    PowerFactor = 0;
   else
-  {
-    tickCnt ++;
-  }
-  previousVoltage = analogInputValue;
+    PowerFactor = Math_SatU16((watts << shift) / voltAmps);
+  // Noise can make the real power slightly larger than the apparent power
+  if (PowerFactor > 256)
+    PowerFactor = 256;
 }
 
-/*! @brief Process latest current and voltage value
+/*! @brief Publishes the measurements of the cycle just processed
  *
- *  @param pData Thread data for voltage thread and current thread.
+ *  Fills the record readers are not using and then makes it the latest one.
  */
-void AnalogLoopbackThread(void* pData)
+static void Publish(void)
 {
-  // Make the code easier to read by giving a name to the typecast'ed pointer
-  #define analogData ((TAnalogThreadData*)pData)
+  TMeterRecord* const record = &Records[(RecordsPublished + 1) & 1];
+
+  record->snapshot.cycle        = BlocksProcessed;
+  record->snapshot.voltageRMS   = VoltageRMS;
+  record->snapshot.currentRMS   = CurrentRMS;
+  record->snapshot.averagePower = AveragePower;
+  record->snapshot.powerFactor  = PowerFactor;
+  record->snapshot.frequency    = Frequency_Get();
+  record->snapshot.energy       = Energy;
+  for (uint8_t reg = 0; reg < TARIFF_NB_REGISTERS; reg++)
+    record->bands[reg] = Bands[reg];
+
+  COMPILER_BARRIER();
+  RecordsPublished ++;
+}
+
+/*! @brief Gets the latest published record, to be copied
+ *
+ *  @param published A pointer to a memory location to place the record's number, for CopyOverwritten.
+ *  @return const TMeterRecord* the record.
+ */
+static const TMeterRecord* LatestRecord(uint32_t* const published)
+{
+  *published = RecordsPublished;
+  COMPILER_BARRIER();
+  return &Records[*published & 1];
+}
 
+/*! @brief Checks whether a record may have changed while it was being copied
+ *
+ *  Readers run at a lower priority than the meter thread, so the meter thread writes a whole
+ *  record while a reader is preempted, and only ever into the record not last published.
+ *  A copy is only overwritten if a second record is published while it is being made.
+ *  @param published Number of the record copied, from LatestRecord.
+ *  @return bool - TRUE if the copy has to be made again.
+ */
+static bool CopyOverwritten(const uint32_t published)
+{
+  COMPILER_BARRIER();
+  return (uint32_t)(RecordsPublished - published) > 1;
+}
+
+/*! @brief The thread will be executed once every block (one cycle of samples).
+ *
+ *  @param pData Thread data(not used)
+ */
+void MeterThread(void* pData)
+{
   for (;;)
   {
-    int16_t analogInputValue;
+    (void)OS_SemaphoreWait(BlockSemaphore, 0);
 
-    (void)OS_SemaphoreWait(analogData->semaphore, 0);
+    uint32_t filled = BlocksFilled;
 
-    if (analogData->channelNb == 1)
-    {
-      analogInputValue = Meter_Voltage;
-      InstantaneousVoltage = Meter_Voltage;
-      MeterFrequency(analogInputValue);
-    }
-    else
+    // Semaphore count left over from blocks that have already been skipped
+    if (filled == BlocksProcessed)
+      continue;
+
+    // The ISR has started overwriting the oldest unprocessed block, skip to the latest one
+    if (filled - BlocksProcessed > 1)
     {
-      analogInputValue = Meter_Current;
-      InstantaneousCurrent = Meter_Current;
+      Meter_BlockOverruns += filled - BlocksProcessed - 1;
+      BlocksProcessed = filled - 1;
     }
 
-    // Convert to 32Q16 format
-    uint32_t convertedValue = analogInputValue*2*10;
-    analogData->queue.latestValue = convertedValue;
+    TSampleBlock* const block = &SampleBlocks[BlocksProcessed % NB_SAMPLE_BLOCKS];
+    uint32_t start = Bench_Start();
 
-    // 32Q16 * 32Q16 = 64Q32
-    // Maximum value of sample is 655360
-    // 655360 * 655360 = 0x 0064 0000 0000
-    // So its square will not exceed 48th bit. It's safe to discard the highest 16 bits
-    uint32_t squared = ((uint64_t)((analogInputValue*2*10)*(uint64_t)(analogInputValue*2*10)) >> 16);
-    SQ_Put(&(analogData->queue), squared);
+    // Samples in this block were taken with the period set after the previous block
+    Frequency_Update(block->voltage, SAMPLES_PER_CYCLE, block->time, MeterPLL.periodQ16);
+    PLL_Update(&MeterPLL, block->voltage);
 
-    // First time, Wait until 16 samples have been retrieved
-    if (*analogData->RMS == 0 && analogData->queue.nb == 16 && analogData->queue.firstTime)
-    {
-      // Calculate RMS for the first time
-      *analogData->RMS = Math_SquareRoot(0, (analogData->queue.sum) >> 4, 0) * analogData->ratio;
-      // In case the actual RMS value is 0
-      analogData->queue.firstTime = false;
-    }
-    // Update every time since the first time
-    else if (!analogData->queue.firstTime)
+    // Current and voltage samples are of base 10/32768
+    // Their squares and products are of base 100/(2^30)
+    TKernelSums sums;
+    uint32_t kernelStart = Bench_Start();
+    Kernel_Accumulate(block->voltage, block->current, SAMPLES_PER_CYCLE, &sums);
+    Bench_Stop(BENCH_METER_KERNEL, kernelStart);
+
+    MeterRMS(&AnalogChannelData[VOLTAGE_INDEX], sums.sumVV);
+    MeterRMS(&AnalogChannelData[CURRENT_INDEX], sums.sumII);
+    uint32_t cycleStart = Bench_Start();
+    MeterCycle(sums.sumVI);
+    Bench_Stop(BENCH_METER_CYCLE, cycleStart);
+
+    Capture_Cycle(BlocksProcessed, block->voltage, block->current);
+    BlocksProcessed ++;
+    // Before the telemetry thread is woken up to read it
+    Publish();
+
+    if (TelemetryPeriod && --TelemetryCountdown == 0)
     {
-      // Since Voltage RMS is no more than 250V, no overflow
-      *analogData->RMS = (Math_SquareRoot(*analogData->RMS/(analogData->ratio), (analogData->queue.sum) >> 4, 1)) * analogData->ratio;
+      TelemetryCountdown = TelemetryPeriod;
+      (void)OS_SemaphoreSignal(TelemetrySemaphore);
     }
+    Bench_Stop(BENCH_METER_BLOCK, start);
+  }
+}
+
+/*! @brief Call back function of Meter module.
+ *
+ *  Samples the voltage and current into the block being filled and hands the block
+ *  to the meter thread once a full cycle has been collected.
+ *  @note This will be called by PIT. Only this ISR writes a block until it is handed over,
+ *        so the pair is always from the same tick.
+ */
+void MeterCallback()
+{
+  TSampleBlock* const block = &SampleBlocks[FillIndex];
+
+  // Sample first, so the time from the interrupt to the conversion does not depend on the PLL
+  Analog_Get(VOLTAGE_CHANNEL, &block->voltage[FillCount]);
+  Analog_Get(CURRENT_CHANNEL, &block->current[FillCount]);
+
+  // This sample was taken one running period after the previous one, and the value
+  // written to the PIT on the previous tick has just been reloaded
+  SampleTime += RunningTicks;
+  RunningTicks = LoadedTicks;
 
-    if (analogData->signal)
-      OS_SemaphoreSignal(analogData->signal);
+  // The PIT picks up the new value when the current period expires, so it is never restarted
+  uint32_t ticks = PLL_NextPeriod(&MeterPLL);
+  if (ticks != LoadedTicks)
+  {
+    PIT_Set(ticks * NsPerTick, false);
+    LoadedTicks = ticks;
+  }
+
+  if (FillCount == 0)
+    block->time = SampleTime;
+
+  if (++FillCount == SAMPLES_PER_CYCLE)
+  {
+    FillCount = 0;
+    FillIndex = (FillIndex + 1) % NB_SAMPLE_BLOCKS;
+    BlocksFilled ++;
+    OS_SemaphoreSignal(BlockSemaphore);
   }
 }
 
-/*! @brief The thread will be executed every sample time.
+/*! @brief Get the energy used in a tariff band
  *
+ *  @param reg Energy register, below TARIFF_NB_REGISTERS
+ *  @return uint64_t energy in Joule, 64Q32
  */
-void CalcThread(void* pData)
+uint64_t Meter_GetBandEnergy(const uint8_t reg)
 {
-  for (;;)
+  uint32_t published;
+  uint64_t energy;
+
+  do
   {
-    (void)OS_SemaphoreWait(CalcSemaphore, 0);
+    energy = LatestRecord(&published)->bands[reg].energy;
+  } while (CopyOverwritten(published));
 
-    static uint8_t cnt = 0;
-    // Calculate energy, cost ..
-    int32_t instantaneousPower  = 0;
-    static int32_t sumOfPower   = 0;
-    uint32_t energyForOnePeriod = 0;
+  return energy;
+}
 
-    // InstantaneousCurrent and InstantaneousVoltage are of base 10/32768
-    // Their product is of base 100/(2^30)
-    instantaneousPower = InstantaneousCurrent * InstantaneousVoltage;
+/*! @brief Get the cost of the energy used in a tariff band, at the rates in force when it was used
+ *
+ *  @param reg Energy register, below TARIFF_NB_REGISTERS
+ *  @return uint64_t cost in cents, 64Q32
+ */
+uint64_t Meter_GetBandCost(const uint8_t reg)
+{
+  uint32_t published;
+  uint64_t cost;
 
-    // According to the input range, int32_t is large enough to hold all the products
-    sumOfPower += instantaneousPower;
-    cnt ++;
+  do
+  {
+    cost = BandCost(&LatestRecord(&published)->bands[reg]);
+  } while (CopyOverwritten(published));
 
-    if (cnt == SAMPLES_PER_CYCLE)
-    {
-      uint64_t energyForOnePeriod;
-      cnt = 0; // reset counter
-      // Convert from base 100/(2^30) to 32Q16(1/2^16)
-      // 100/(2^30) * (2^16) = 25/4096 = 1/164
-      sumOfPower = (sumOfPower + 82) / 164;
-
-      // Handle situations when Voltage's frequency and Current's frequency don't match
-      if (sumOfPower < 0)
-      {
-        sumOfPower = 0;
-      }
-      // 32Q16 * 32Q16 = 64Q32, 100 is the ratio of raw to output
-      energyForOnePeriod = (uint64_t)sumOfPower * (uint64_t)Protocol_GetTime(100) ;
-      Meter_Energy += energyForOnePeriod;
-
-      Meter_AveragePower = sumOfPower * 100 / 16 / 1000;
-
-      // 64Q32 / 32Q16 = 64Q16
-      // convert from 64Q16 to 16Q8
-      Meter_PowerFactor = (uint16_t)(((((uint64_t)Meter_VoltageRMS*(uint64_t)Meter_CurrentRMS) << 16)/(1000 * Meter_AveragePower)) >> 8);
-
-      // Convert energy from Joule to kWh and 64Q32 to 32Q16
-      uint64_t cost = 0;;
-      uint64_t rate = Tariff_GetRate();
-      cost = (energyForOnePeriod >> 16) ;
-      cost *= rate;
-      cost /= 3600000;
-
-      Meter_Cost += cost;
-      sumOfPower = 0;
-    }
+  return cost;
+}
+
+/*! @brief Price all the bands of a record
+ *
+ *  @param record A pointer to the record
+ *  @return uint64_t cost in cents, 64Q32
+ */
+static uint64_t RecordCost(const TMeterRecord* const record)
+{
+  uint64_t cost = 0;
+
+  for (uint8_t reg = 0; reg < TARIFF_NB_REGISTERS; reg++)
+    cost += BandCost(&record->bands[reg]);
+  return cost;
+}
+
+/*! @brief Get the total cost of the energy used
+ *
+ *  @return uint64_t cost in cents, 64Q32
+ */
+uint64_t Meter_GetCost(void)
+{
+  uint32_t published;
+  uint64_t cost;
+
+  // Price all the bands of the same record, outside the meter thread
+  do
+  {
+    cost = RecordCost(LatestRecord(&published));
+  } while (CopyOverwritten(published));
+
+  return cost;
+}
+
+/*! @brief Get a copy of the measurements, all from the same cycle
+ *
+ *  @param snapshot A pointer to a memory location to place the copy.
+ *  @note Never masks interrupts. Must be called from a thread with a lower priority than the meter thread.
+ */
+void Meter_GetSnapshot(TMeterSnapshot* const snapshot)
+{
+  uint32_t published;
+
+  // The cost is priced from the band registers of the record the rest is copied from
+  do
+  {
+    const TMeterRecord* const record = LatestRecord(&published);
+
+    *snapshot = record->snapshot;
+    snapshot->cost = RecordCost(record);
+  } while (CopyOverwritten(published));
+}
+
+/*! @brief Sets how often the meter thread signals that a telemetry record is due
+ *
+ *  @param period Number of cycles between records, 0 to stop, at most METER_TELEMETRY_MAX_PERIOD.
+ *  @param semaphore The semaphore to signal at the end of every period.
+ *  @return bool - TRUE if the period was in range.
+ *  @note The first record is due at the end of the first whole period after the call.
+ */
+bool Meter_SetTelemetry(const uint16_t period, OS_ECB* const semaphore)
+{
+  if (period > METER_TELEMETRY_MAX_PERIOD)
+    return false;
+
+  // The meter thread has a higher priority than any caller
+  OS_DisableInterrupts();
+  TelemetrySemaphore = semaphore;
+  TelemetryCountdown = period;
+  TelemetryPeriod    = period;
+  OS_EnableInterrupts();
+  return true;
+}
+
+/*! @brief Gets the average power in W.
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
+ */
+static bool HandlePower(const TCommandPacket* const packet)
+{
+  TMeterSnapshot snapshot;
+  uint16union_t power;
+
+  Meter_GetSnapshot(&snapshot);
+  // 32Q16 kW to W
+  power.l = Math_SatU16(Math_MulWideU(snapshot.averagePower, 1000) >> 16);
+  return MyPacket_Put(CMD_POWER, power.s.Lo, power.s.Hi, 0);
+}
+
+/*! @brief Gets the total energy in Wh.
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
+ */
+static bool HandleEnergy(const TCommandPacket* const packet)
+{
+  TMeterSnapshot snapshot;
+  uint16union_t energy;
+
+  Meter_GetSnapshot(&snapshot);
+  // 64Q32 Joule to Wh
+  energy.l = Math_SatU16(Math_RecipMul(snapshot.energy, PerHour) >> 32);
+  return MyPacket_Put(CMD_ENERGY, energy.s.Lo, energy.s.Hi, 0);
+}
+
+/*! @brief Gets the total cost, cents in parameter 1 and dollars in parameters 2 and 3.
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
+ */
+static bool HandleCost(const TCommandPacket* const packet)
+{
+  uint32_t totalCents = Math_SatU32(Meter_GetCost() >> 32);
+  uint8_t cents = totalCents % 100;
+  uint16union_t dollars;
+  dollars.l = Math_SatU16(totalCents / 100);
+
+  return MyPacket_Put(CMD_COST, cents, dollars.s.Lo, dollars.s.Hi);
+}
 
+/*! @brief Gets the frequency in 0.1 Hz.
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
+ */
+static bool HandleFrequency(const TCommandPacket* const packet)
+{
+  uint16union_t freq;
+  // mHz to 0.1 Hz
+  freq.l = (uint16_t)((Frequency_Get() + 50) / 100);
+  return MyPacket_Put(packet->command, freq.s.Lo, freq.s.Hi, 0);
+}
+
+/*! @brief Gets the frequency in mHz (parameter 1 = 0) or its rate of change in mHz/s (parameter 1 = 1).
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
+ */
+static bool HandleFrequencyMHz(const TCommandPacket* const packet)
+{
+  if (packet->parameter1 == 0)
+  {
+    // Frequency in mHz, 45 Hz to 65 Hz fits in 16 bits
+    uint16union_t freq;
+    freq.l = (uint16_t)Frequency_Get();
+    return MyPacket_Put(CMD_FREQUENCY_MHZ, freq.s.Lo, freq.s.Hi, packet->parameter1);
+  }
+
+  if (packet->parameter1 == 1)
+  {
+    // Rate of change of frequency in mHz/s, saturated to 16 bits
+    int32_t rocof = Frequency_GetROCOF();
+    int16union_t rate;
+
+    if (rocof > INT16_MAX)
+      rocof = INT16_MAX;
+    else if (rocof < INT16_MIN)
+      rocof = INT16_MIN;
+    rate.l = (int16_t)rocof;
+    return MyPacket_Put(CMD_FREQUENCY_MHZ, (uint8_t)rate.s.Lo, (uint8_t)rate.s.Hi, packet->parameter1);
   }
+
+  return false;
 }
 
-/*! @brief Call back function of Meter module.
+/*! @brief Gets the RMS voltage in 16Q8.
  *
- *  @note This will be called by PIT
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
  */
-void MeterCallback()
+static bool HandleVoltageRMS(const TCommandPacket* const packet)
+{
+  TMeterSnapshot snapshot;
+  uint16union_t volt;
+
+  Meter_GetSnapshot(&snapshot);
+  volt.l = snapshot.voltageRMS;
+
+  return MyPacket_Put(packet->command, volt.s.Lo, volt.s.Hi, 0);
+}
+
+/*! @brief Gets the RMS current in 16Q8.
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
+ */
+static bool HandleCurrentRMS(const TCommandPacket* const packet)
+{
+  TMeterSnapshot snapshot;
+  uint16union_t curr;
+
+  Meter_GetSnapshot(&snapshot);
+  curr.l = snapshot.currentRMS;
+
+  return MyPacket_Put(packet->command, curr.s.Lo, curr.s.Hi, 0);
+}
+
+/*! @brief Gets the power factor x1000.
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
+ */
+static bool HandlePowerFactor(const TCommandPacket* const packet)
 {
-  OS_SemaphoreSignal(AnalogThreadData[VOLTAGE_THREAD].semaphore);
-  OS_SemaphoreSignal(AnalogThreadData[CURRENT_THREAD].semaphore);
+  TMeterSnapshot snapshot;
+  uint16union_t pf;
+
+  Meter_GetSnapshot(&snapshot);
+  pf.l = (uint16_t)(((uint32_t)snapshot.powerFactor*1000) >> 8);
+
+  return MyPacket_Put(packet->command, pf.s.Lo, pf.s.Hi, 0);
+}
+
+/*! @brief Gets the energy (parameter 2 = 0) or cost (parameter 2 = 1) of the register in parameter 1.
+ *
+ *  @param packet A pointer to the packet received.
+ *  @return bool - TRUE if the command was carried out.
+ */
+static bool HandleBand(const TCommandPacket* const packet)
+{
+  uint8_t reg = packet->parameter1;
+  uint64_t value;
+
+  if (reg >= TARIFF_NB_REGISTERS)
+    return false;
+
+  if (packet->parameter2 == 0)
+    // 64Q32 Joule to Wh
+    value = Math_RecipMul(Meter_GetBandEnergy(reg), PerHour) >> 32;
+  else if (packet->parameter2 == 1)
+    // 64Q32 cents to cents
+    value = Meter_GetBandCost(reg) >> 32;
+  else
+    return false;
+
+  // Saturate to the 24 bits available in a packet
+  if (value > 0xFFFFFF)
+    value = 0xFFFFFF;
+
+  return MyPacket_Put(CMD_BAND, (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16));
 }
 
 /*! @brief Initialize meter module by creating threads and enabling timer.
@@ -276,38 +694,64 @@ bool Meter_Init(const uint32_t moduleClk)
 {
   OS_ERROR error;
 
-  Meter_VoltageRMS = 0;
-  Meter_CurrentRMS = 0;
-  Meter_Energy = 0;
-  Meter_Cost   = 0;
-  Phase  = 0;
-
-  // Generate the global analog semaphores
-  for (uint8_t analogNb = 0; analogNb < NB_ANALOG_CHANNELS; analogNb++)
+  VoltageRMS = 0;
+  CurrentRMS = 0;
+  AveragePower = 0;
+  PowerFactor = 0;
+  Energy = 0;
+  RateVersion = Tariff_GetRateVersion();
+  for (uint8_t reg = 0; reg < TARIFF_NB_REGISTERS; reg++)
   {
-    AnalogThreadData[analogNb].semaphore = OS_SemaphoreCreate(0);
-    SQ_Init(&AnalogThreadData[analogNb].queue);
+    Bands[reg].energy = 0;
+    Bands[reg].unpriced = 0;
+    Bands[reg].charged = 0;
+    Bands[reg].rate = Tariff_GetRegisterRate(reg);
   }
+  Phase  = 0;
 
-  CalcSemaphore = OS_SemaphoreCreate(0);
-  AnalogThreadData[CURRENT_THREAD].signal = CalcSemaphore;
-
-  error |= OS_ThreadCreate(CalcThread,
-                           NULL,
-                           &CalcThreadStack[THREAD_STACK_SIZE - 1],
-                           8);
+  Meter_BlockOverruns = 0;
 
-  for (uint8_t threadNb = 0; threadNb < NB_ANALOG_CHANNELS; threadNb ++)
+  for (uint8_t analogNb = 0; analogNb < NB_ANALOG_CHANNELS; analogNb++)
   {
-    error |= OS_ThreadCreate(AnalogLoopbackThread,
-                             &AnalogThreadData[threadNb],
-                             &AnalogThreadStacks[threadNb][THREAD_STACK_SIZE - 1],
-                             ANALOG_THREAD_PRIORITIES[threadNb]);
+    AnalogChannelData[analogNb].firstTime = true;
   }
 
+  FillIndex = 0;
+  FillCount = 0;
+  BlocksFilled = 0;
+  BlocksProcessed = 0;
+  BlockSemaphore = OS_SemaphoreCreate(0);
+  TelemetryPeriod = 0;
+
+  NsPerTick = NANO_SECONDS_IN_A_SECOND / moduleClk;
+  LoadedTicks = SAMPLE_PERIOD / NsPerTick;
+  RunningTicks = LoadedTicks;
+  SampleTime = 0;
+  Frequency_Init(moduleClk);
+  PLL_Init(&MeterPLL, SAMPLES_PER_CYCLE, LoadedTicks, SAMPLE_PERIOD_MIN / NsPerTick, SAMPLE_PERIOD_MAX / NsPerTick);
+
+  // Readers see the cleared measurements until the first cycle has been processed
+  RecordsPublished = 0;
+  Publish();
+
+  (void)Command_Register(CMD_POWER, HandlePower);
+  (void)Command_Register(CMD_ENERGY, HandleEnergy);
+  (void)Command_Register(CMD_COST, HandleCost);
+  (void)Command_Register(CMD_FREQUENCY, HandleFrequency);
+  (void)Command_Register(CMD_VOLTAGE_RMS, HandleVoltageRMS);
+  (void)Command_Register(CMD_CURRENT_RMS, HandleCurrentRMS);
+  (void)Command_Register(CMD_POWER_FACTOR, HandlePowerFactor);
+  (void)Command_Register(CMD_FREQUENCY_MHZ, HandleFrequencyMHz);
+  (void)Command_Register(CMD_BAND, HandleBand);
+
+  error = OS_ThreadCreate(MeterThread,
+                          NULL,
+                          &MeterThreadStack[THREAD_STACK_SIZE - 1],
+                          3);
+
   if (PIT_Init(moduleClk, MeterCallback, NULL))
   {
-    PIT_Set(TickPeriod, true);
+    PIT_Set(SAMPLE_PERIOD, true);
   }
   return !error;
 }
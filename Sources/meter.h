@@ -2,36 +2,111 @@
 #define METER_H
 
 #include "types.h"
+#include "OS.h"
 
 #define CYCLES_PER_SECOND 50
+
+// Sample density, set with -DSAMPLES_PER_CYCLE=n to any of 16, 32, 64 or 128
+#ifndef SAMPLES_PER_CYCLE
 #define SAMPLES_PER_CYCLE 16
+#endif
+
+#if SAMPLES_PER_CYCLE == 16
+#define SAMPLES_PER_CYCLE_SHIFT 4
+#elif SAMPLES_PER_CYCLE == 32
+#define SAMPLES_PER_CYCLE_SHIFT 5
+#elif SAMPLES_PER_CYCLE == 64
+#define SAMPLES_PER_CYCLE_SHIFT 6
+#elif SAMPLES_PER_CYCLE == 128
+#define SAMPLES_PER_CYCLE_SHIFT 7
+#else
+#error "SAMPLES_PER_CYCLE must be 16, 32, 64 or 128"
+#endif
+
+// Longest telemetry period, one minute of cycles
+#define METER_TELEMETRY_MAX_PERIOD (CYCLES_PER_SECOND * 60)
+
+#define NANO_SECONDS_IN_A_SECOND 1000000000
+#define JOULES_PER_KWH 3600000
+
+// 16 samples per cycle(50Hz) is 800 Hz, a tick every 1.25 ms which is 1250000 ns
+#define SAMPLE_PERIOD (NANO_SECONDS_IN_A_SECOND / (CYCLES_PER_SECOND * SAMPLES_PER_CYCLE))
+
+// Sample period in seconds, 32Q16, multiplied by 100 to reduce precision lose (8192 at 16 samples per cycle)
+#define SAMPLE_PERIOD_Q16_X100 (SAMPLE_PERIOD * 65536LL * 100 / NANO_SECONDS_IN_A_SECOND)
+
+#if NANO_SECONDS_IN_A_SECOND % (CYCLES_PER_SECOND * SAMPLES_PER_CYCLE) != 0
+#error "Sample period is not a whole number of nanoseconds"
+#endif
+#if (SAMPLE_PERIOD * 65536 * 100) % NANO_SECONDS_IN_A_SECOND != 0
+#error "Sample period can not be represented exactly in 32Q16"
+#endif
+// Samples are 16-bit, so a cycle's sum of V*I is below SAMPLES_PER_CYCLE * 2^30.
+// It has to fit in 32 bits once converted to 32Q16 (multiplied by 25/4096)
+#if SAMPLES_PER_CYCLE * 1073741824LL * 25 / 4096 > 0x7FFFFFFF
+#error "Sum of power of one cycle overflows 32 bits"
+#endif
+// Energy of one cycle in 64Q32: sum of power (32Q16) * period (32Q16) * 3600 in accelerated test mode
+#if (SAMPLES_PER_CYCLE * 1073741824LL * 25 / 4096) * SAMPLE_PERIOD_Q16_X100 * 3600 > 0x7FFFFFFFFFFFFFFF
+#error "Energy of one cycle overflows 64 bits"
+#endif
+
+/*!
+ * @struct TMeterSnapshot
+ */
+typedef struct
+{
+  uint32_t cycle;          /*!< Number of the last cycle included */
+  uint16_t voltageRMS;     /*!< 16Q8 */
+  uint16_t currentRMS;     /*!< 16Q8 */
+  uint32_t averagePower;   /*!< kW, 32Q16 */
+  uint16_t powerFactor;    /*!< 16Q8 */
+  uint32_t frequency;      /*!< mHz */
+  uint64_t energy;         /*!< Joule, 64Q32 */
+  uint64_t cost;           /*!< cents, 64Q32 */
+} TMeterSnapshot;
 
-// 16 samples per cycle(50Hz) which is 800 Hz
-// Tick every 1.25 ms which is 1250000 ns
-#define SAMPLE_PERIOD 1250000
-// 0.1 Hz for 16 samples per cycle
-#define SAMPLE_TIME_INCREMENT 2506
+extern uint32_t Meter_BlockOverruns; /*!< Number of sample blocks dropped because the meter thread fell behind */
 
-extern int16_t Meter_Voltage;
-extern int16_t Meter_Current;
+/*! @brief Get the energy used in a tariff band
+ *
+ *  @param reg Energy register, below TARIFF_NB_REGISTERS
+ *  @return uint64_t energy in Joule, 64Q32
+ */
+uint64_t Meter_GetBandEnergy(const uint8_t reg);
 
-extern uint16_t Meter_VoltageRMS;
-extern uint16_t Meter_CurrentRMS;
+/*! @brief Get the cost of the energy used in a tariff band, at the rates in force when it was used
+ *
+ *  @param reg Energy register, below TARIFF_NB_REGISTERS
+ *  @return uint64_t cost in cents, 64Q32
+ */
+uint64_t Meter_GetBandCost(const uint8_t reg);
+
+/*! @brief Get the total cost of the energy used
+ *
+ *  @return uint64_t cost in cents, 64Q32
+ */
+uint64_t Meter_GetCost(void);
 
+/*! @brief Get a copy of the measurements, all from the same cycle
+ *
+ *  @param snapshot A pointer to a memory location to place the copy.
+ *  @note Never masks interrupts. Must be called from a thread with a lower priority than the meter thread.
+ */
+void Meter_GetSnapshot(TMeterSnapshot* const snapshot);
 
-extern uint32_t Meter_AveragePower;  /*!< P=VIcos, calculated every cycle(after sampling current and voltage 16 times)  */
-extern uint64_t Meter_Energy;        /*!< E=sum(p)*Ts, calculated every period */
-extern uint64_t Meter_Cost;          /*!< Cost of electricity, calculated every period */
-extern uint16_t Meter_PowerFactor;
+/*! @brief Sets how often the meter thread signals that a telemetry record is due
+ *
+ *  @param period Number of cycles between records, 0 to stop, at most METER_TELEMETRY_MAX_PERIOD.
+ *  @param semaphore The semaphore to signal at the end of every period.
+ *  @return bool - TRUE if the period was in range.
+ *  @note The first record is due at the end of the first whole period after the call.
+ */
+bool Meter_SetTelemetry(const uint16_t period, OS_ECB* const semaphore);
 
 /*! @brief Initialize meter module by creating threads and enabling timer.
  *  @param moduleClk The module clock rate in Hz.
  */
 bool Meter_Init(const uint32_t moduleClk);
 
-/*! @brief Get the frequency difference between current frequency and 1/(16*47.5)Hz
- *
- *  @return uint8_t difference, from 0 to 50, represents 1/(16*52.5) to 1/(16*47.5) respectively.
- */
-uint8_t Meter_GetFrequencyDiff();
 #endif
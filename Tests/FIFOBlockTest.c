@@ -0,0 +1,213 @@
+/*! @file
+ *
+ *  @brief Host benchmark of FIFO_PutBlock and FIFO_GetBlock against FIFO_Put and FIFO_Get.
+ *
+ *  Every byte is checked. The uncontended runs put and then get in one thread, across the end of
+ *  the buffer. The threaded runs have a producer and a consumer thread pinned to one CPU, like the
+ *  threads on the target.
+ *  Usage: FIFOBlockTest [number of bytes]
+ *
+ *  @author Zhengjie Huang
+ *  @date 2017-10-17
+ */
+
+#define _GNU_SOURCE
+#include "FIFO.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Bytes sent in each run unless given on the command line
+#define NB_BYTES 4000000
+
+// Largest block the consumer asks for
+#define READ_SIZE 256
+
+static const uint16_t WriteSizes[] = {5, 32, 128};
+
+static TFIFO FIFO;
+static long NbBytes = NB_BYTES;
+static uint16_t WriteSize;
+static bool UseBlocks;
+
+/*! @brief Gets the time.
+ *
+ *  @return double the time in seconds.
+ */
+static double Now(void)
+{
+  struct timespec time;
+
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+/*! @brief Gets the byte expected at a position of the stream.
+ *
+ *  @param index Position in the stream.
+ *  @return uint8_t the byte.
+ */
+static uint8_t Expected(const long index)
+{
+  return (uint8_t)(index * 7);
+}
+
+/*! @brief Stops the test if a byte is not the one expected.
+ *
+ *  @param data The bytes received.
+ *  @param nbBytes Number of bytes received.
+ *  @param index Position in the stream of the first byte.
+ */
+static void Check(const uint8_t* const data, const uint16_t nbBytes, const long index)
+{
+  for (uint16_t i = 0; i < nbBytes; i++)
+  {
+    if (data[i] != Expected(index + i))
+    {
+      printf("FAIL byte %ld is %u\n", index + i, data[i]);
+      exit(1);
+    }
+  }
+}
+
+/*! @brief Writes the stream in writes of WriteSize bytes, with blocks or one byte at a time.
+ *
+ *  @param argument Not used.
+ *  @return void* NULL.
+ */
+static void* Producer(void* argument)
+{
+  uint8_t data[READ_SIZE];
+
+  (void)argument;
+  for (long i = 0; i < NbBytes; )
+  {
+    uint16_t nbBytes = (NbBytes - i < WriteSize) ? (uint16_t)(NbBytes - i) : WriteSize;
+
+    for (uint16_t k = 0; k < nbBytes; k++)
+      data[k] = Expected(i + k);
+
+    if (UseBlocks)
+    {
+      for (uint16_t sent = 0; sent < nbBytes; )
+        sent += FIFO_PutBlock(&FIFO, &data[sent], nbBytes - sent);
+    }
+    else
+    {
+      for (uint16_t k = 0; k < nbBytes; k++)
+        (void)FIFO_Put(&FIFO, data[k]);
+    }
+    i += nbBytes;
+  }
+  return NULL;
+}
+
+/*! @brief Runs the producer thread against a consumer that reads blocks or single bytes.
+ *
+ *  @return double bytes per microsecond.
+ */
+static double RunThreads(void)
+{
+  pthread_t producer;
+  uint8_t data[READ_SIZE];
+
+  FIFO_Init(&FIFO);
+  double start = Now();
+
+  if (pthread_create(&producer, NULL, Producer, NULL) != 0)
+    exit(1);
+
+  for (long i = 0; i < NbBytes; )
+  {
+    uint16_t nbBytes = 1;
+
+    if (UseBlocks)
+      nbBytes = FIFO_GetBlock(&FIFO, data, READ_SIZE);
+    else
+      (void)FIFO_Get(&FIFO, data);
+    Check(data, nbBytes, i);
+    i += nbBytes;
+  }
+
+  (void)pthread_join(producer, NULL);
+  return NbBytes / (Now() - start) * 1e-6;
+}
+
+/*! @brief Puts WriteSize bytes and gets them back, over and over, in one thread.
+ *
+ *  @return double bytes per microsecond.
+ */
+static double RunUncontended(void)
+{
+  uint8_t in[READ_SIZE], out[READ_SIZE];
+  long nbWrites = NbBytes / WriteSize;
+
+  FIFO_Init(&FIFO);
+  for (uint16_t k = 0; k < WriteSize; k++)
+    in[k] = Expected(k);
+
+  double start = Now();
+
+  for (long n = 0; n < nbWrites; n++)
+  {
+    if (UseBlocks)
+    {
+      if (FIFO_PutBlock(&FIFO, in, WriteSize) != WriteSize || FIFO_GetBlock(&FIFO, out, WriteSize) != WriteSize)
+        exit(1);
+    }
+    else
+    {
+      for (uint16_t k = 0; k < WriteSize; k++)
+        (void)FIFO_Put(&FIFO, in[k]);
+      for (uint16_t k = 0; k < WriteSize; k++)
+        (void)FIFO_Get(&FIFO, &out[k]);
+    }
+    if (memcmp(out, in, WriteSize) != 0)
+    {
+      printf("FAIL write %ld\n", n);
+      exit(1);
+    }
+  }
+
+  return nbWrites * WriteSize / (Now() - start) * 1e-6;
+}
+
+int main(int argc, char* argv[])
+{
+  cpu_set_t cpus;
+
+  if (argc > 1)
+    NbBytes = atol(argv[1]);
+
+  // One core, as on the target
+  CPU_ZERO(&cpus);
+  CPU_SET(0, &cpus);
+  (void)sched_setaffinity(0, sizeof(cpus), &cpus);
+
+  for (size_t i = 0; i < sizeof(WriteSizes) / sizeof(WriteSizes[0]); i++)
+  {
+    WriteSize = WriteSizes[i];
+    UseBlocks = true;
+    double blocks = RunUncontended();
+    UseBlocks = false;
+    double bytes = RunUncontended();
+
+    printf("uncontended %3u byte blocks:   block %6.1f, per byte %6.1f bytes/us\n", WriteSize, blocks, bytes);
+  }
+
+  for (size_t i = 0; i < sizeof(WriteSizes) / sizeof(WriteSizes[0]); i++)
+  {
+    WriteSize = WriteSizes[i];
+    UseBlocks = true;
+    double blocks = RunThreads();
+    UseBlocks = false;
+    double bytes = RunThreads();
+
+    printf("two threads %3u byte writes:   block %6.1f, per byte %6.1f bytes/us\n", WriteSize, blocks, bytes);
+  }
+  return 0;
+}
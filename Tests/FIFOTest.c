@@ -0,0 +1,120 @@
+/*! @file
+ *
+ *  @brief Host benchmark of FIFO_Put and FIFO_Get between a producer and a consumer thread.
+ *
+ *  Every byte is checked in order. The threads are pinned to one CPU, like the threads on the
+ *  target, and the OS calls they make per byte are counted. "make FIFO_DIR=<dir>" builds it against
+ *  the FIFO.c and FIFO.h in another directory, to compare implementations.
+ *  Usage: FIFOTest [number of bytes]
+ *
+ *  @author Zhengjie Huang
+ *  @date 2017-10-17
+ */
+
+#define _GNU_SOURCE
+#include "FIFO.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Bytes sent in each run unless given on the command line
+#define NB_BYTES 2000000
+
+// Work the producer does between bursts, so the consumer empties the FIFO and waits
+#define BURST_LENGTH 5
+#define BURST_GAP 2000
+
+static TFIFO FIFO;
+static long NbBytes = NB_BYTES;
+static bool Bursts;
+
+/*! @brief Gets the time.
+ *
+ *  @return double the time in seconds.
+ */
+static double Now(void)
+{
+  struct timespec time;
+
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+/*! @brief Puts a known sequence of bytes into the FIFO, one at a time.
+ *
+ *  @param argument Not used.
+ *  @return void* NULL.
+ */
+static void* Producer(void* argument)
+{
+  (void)argument;
+  for (long i = 0; i < NbBytes; i++)
+  {
+    (void)FIFO_Put(&FIFO, (uint8_t)(i * 7));
+    if (Bursts && i % BURST_LENGTH == BURST_LENGTH - 1)
+    {
+      for (volatile int k = 0; k < BURST_GAP; k++)
+        ;
+    }
+  }
+  return NULL;
+}
+
+/*! @brief Runs the producer against a consumer that checks every byte, and prints the cost per byte.
+ *
+ *  @param name Name of the run.
+ *  @return bool - TRUE if every byte arrived in order.
+ */
+static bool Run(const char* const name)
+{
+  pthread_t producer;
+  uint8_t data;
+
+  FIFO_Init(&FIFO);
+  OS_SemaphoreCalls = 0;
+  double start = Now();
+
+  if (pthread_create(&producer, NULL, Producer, NULL) != 0)
+    return false;
+
+  for (long i = 0; i < NbBytes; i++)
+  {
+    (void)FIFO_Get(&FIFO, &data);
+    if (data != (uint8_t)(i * 7))
+    {
+      printf("FAIL %s: byte %ld is %u\n", name, i, data);
+      exit(1);
+    }
+  }
+
+  (void)pthread_join(producer, NULL);
+  double seconds = Now() - start;
+
+  printf("%-12s %ld bytes, %.2f semaphore calls/byte, %.1f ns/byte\n",
+         name, NbBytes, (double)OS_SemaphoreCalls / NbBytes, seconds * 1e9 / NbBytes);
+  return true;
+}
+
+int main(int argc, char* argv[])
+{
+  cpu_set_t cpus;
+
+  if (argc > 1)
+    NbBytes = atol(argv[1]);
+
+  // One core, as on the target
+  CPU_ZERO(&cpus);
+  CPU_SET(0, &cpus);
+  (void)sched_setaffinity(0, sizeof(cpus), &cpus);
+
+  Bursts = false;
+  if (!Run("streaming:"))
+    return 1;
+  Bursts = true;
+  if (!Run("bursts of 5:"))
+    return 1;
+  return 0;
+}
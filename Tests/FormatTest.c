@@ -0,0 +1,336 @@
+/*! @file
+ *
+ *  @brief Host tests and benchmark for the number formatting in Format.c.
+ *
+ *  Every routine is checked character for character against snprintf. The display lines are built
+ *  both the way Display.c builds them and with the snprintf formats it used before, and compared
+ *  for time, stack used and output. Build and run with "make" in this directory.
+ *
+ *  @author Zhengjie Huang
+ *  @date 2017-10-17
+ */
+
+#include "Format.h"
+#include "Math.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LABEL_LENGTH 4
+
+// Lines built for each time measurement
+#define NB_TIMED 2000000
+
+// Stack given to the thread whose use is measured, painted with a known byte first
+#define STACK_SIZE (128 * 1024)
+#define STACK_PAINT 0xA5
+
+static unsigned long Failures;
+
+/*! @brief Records a mismatch.
+ *
+ *  @param name What was formatted.
+ *  @param input The input that failed.
+ *  @param got Text written.
+ *  @param expected Text of snprintf.
+ */
+static void Check(const char* const name, const unsigned long input, const char* const got, const char* const expected)
+{
+  if (strcmp(got, expected) == 0)
+    return;
+
+  if (Failures < 20)
+    printf("FAIL %s(%lu): got \"%s\", expected \"%s\"\n", name, input, got, expected);
+  Failures++;
+}
+
+/*! @brief Builds a labelled 32Q16 line as Display.c does.
+ *
+ *  @param buffer A pointer to the line, at least LABEL_LENGTH + FORMAT_Q16_MAX_LENGTH(4) + 2 characters.
+ *  @param label The label, 4 characters.
+ *  @param number The number in 32Q16 format.
+ *  @param nbDecimals Number of decimals.
+ *  @param maxInteger Largest integer part that fits on the display.
+ *  @param overflow What is written instead of a number that does not fit.
+ *  @return int number of characters in the line.
+ */
+static __attribute__((noinline)) int FormatQ16Line(char* const buffer, const char* const label, const uint32_t number,
+                                                   const uint8_t nbDecimals, const uint16_t maxInteger,
+                                                   const char* const overflow)
+{
+  int length = LABEL_LENGTH;
+
+  memcpy(buffer, label, LABEL_LENGTH);
+  if ((number >> 16) > maxInteger)
+  {
+    int overflowLength = (int)strlen(overflow);
+
+    memcpy(&buffer[length], overflow, overflowLength);
+    length += overflowLength;
+  }
+  else
+  {
+    length += Format_Q16(&buffer[length], number, nbDecimals);
+  }
+  buffer[length++] = '\n';
+  buffer[length] = '\0';
+  return length;
+}
+
+/*! @brief Builds a labelled 32Q16 line with snprintf, as Display.c did before Format.c.
+ *
+ *  @return int number of characters in the line.
+ */
+static __attribute__((noinline)) int PrintfQ16Line(char* const buffer, const char* const label, const uint32_t number,
+                                                   const uint8_t nbDecimals, const uint16_t maxInteger,
+                                                   const char* const overflow)
+{
+  uint16_t integer = (uint16_t)(number >> 16);
+  uint16_t decimal = Math_Q16Fraction(number, (nbDecimals == 3) ? 1000 : 100);
+
+  if (integer > maxInteger)
+    return snprintf(buffer, 14, "%s%s\n", label, overflow);
+  if (nbDecimals == 3)
+    return snprintf(buffer, 14, "%s%d.%03d\n", label, integer, decimal);
+  return snprintf(buffer, 14, "%s%d.%02d\n", label, integer, decimal);
+}
+
+/*! @brief Builds the metering time line as Display.c does.
+ *
+ *  @return int number of characters in the line.
+ */
+static __attribute__((noinline)) int FormatTimeLine(char* const buffer, const uint8_t day, const uint8_t hour,
+                                                    const uint8_t minute, const uint8_t second)
+{
+  memcpy(buffer, "Time: ", 6);
+  Format_Digits(&buffer[6], day, 2);
+  buffer[8] = ':';
+  Format_Digits(&buffer[9], hour, 2);
+  buffer[11] = ':';
+  Format_Digits(&buffer[12], minute, 2);
+  buffer[14] = ':';
+  Format_Digits(&buffer[15], second, 2);
+  buffer[17] = '\n';
+  buffer[18] = '\0';
+  return 18;
+}
+
+/*! @brief Builds the metering time line with snprintf, as Display.c did before Format.c.
+ *
+ *  @return int number of characters in the line.
+ */
+static __attribute__((noinline)) int PrintfTimeLine(char* const buffer, const uint8_t day, const uint8_t hour,
+                                                    const uint8_t minute, const uint8_t second)
+{
+  return snprintf(buffer, 20, "Time: %02d:%02d:%02d:%02d\n", day, hour, minute, second);
+}
+
+/*! @brief Checks Format_Digits for every value of every width.
+ */
+static void TestDigits(void)
+{
+  char got[8], expected[8];
+
+  for (uint8_t nbDigits = 1; nbDigits <= 5; nbDigits++)
+  {
+    uint32_t end = (nbDigits == 5) ? 65536 : (nbDigits == 4) ? 10000 : (nbDigits == 3) ? 1000 : (nbDigits == 2) ? 100 : 10;
+
+    for (uint32_t value = 0; value < end; value++)
+    {
+      Format_Digits(got, (uint16_t)value, nbDigits);
+      got[nbDigits] = '\0';
+      snprintf(expected, sizeof(expected), "%0*u", nbDigits, (unsigned)value);
+      Check("Format_Digits", value, got, expected);
+    }
+  }
+}
+
+/*! @brief Checks Format_Unsigned for every 16 bit number.
+ */
+static void TestUnsigned(void)
+{
+  char got[8], expected[8];
+
+  for (uint32_t value = 0; value < 65536; value++)
+  {
+    uint8_t length = Format_Unsigned(got, (uint16_t)value);
+
+    got[length] = '\0';
+    snprintf(expected, sizeof(expected), "%u", (unsigned)value);
+    Check("Format_Unsigned", value, got, expected);
+    if (length > FORMAT_UNSIGNED_MAX_LENGTH)
+      Check("Format_Unsigned length", value, "", "");
+  }
+}
+
+/*! @brief Checks Format_Q16 with 1 to 4 decimals across the whole 32Q16 range.
+ */
+static void TestQ16(void)
+{
+  static const uint16_t Scales[] = {0, 10, 100, 1000, 10000};
+  char got[16], expected[16];
+
+  for (uint8_t nbDecimals = 1; nbDecimals <= 4; nbDecimals++)
+  {
+    for (uint64_t number = 0; number <= 0xFFFFFFFFull; number += (number < 0x40000) ? 1 : 4093)
+    {
+      uint8_t length = Format_Q16(got, (uint32_t)number, nbDecimals);
+
+      got[length] = '\0';
+      snprintf(expected, sizeof(expected), "%u.%0*u", (unsigned)(number >> 16), nbDecimals,
+               (unsigned)Math_Q16Fraction((uint32_t)number, Scales[nbDecimals]));
+      Check("Format_Q16", (unsigned long)number, got, expected);
+      if (length > FORMAT_Q16_MAX_LENGTH(nbDecimals))
+        Check("Format_Q16 length", (unsigned long)number, "", "");
+    }
+  }
+}
+
+/*! @brief Checks that the display lines are the same as the ones snprintf made, including numbers that do not fit.
+ */
+static void TestLines(void)
+{
+  char got[32], expected[32];
+
+  for (uint32_t number = 0; number <= 0x03FFFFFF; number += 61)
+  {
+    FormatQ16Line(got, "AP: ", number, 3, 999, "xxx.xxx");
+    PrintfQ16Line(expected, "AP: ", number, 3, 999, "xxx.xxx");
+    Check("AP line", number, got, expected);
+  }
+
+  for (uint64_t number = 0; number <= 0xFFFFFFFFull; number += 1021)
+  {
+    FormatQ16Line(got, "TC: ", (uint32_t)number, 2, 9999, "xxxx.xx");
+    PrintfQ16Line(expected, "TC: ", (uint32_t)number, 2, 9999, "xxxx.xx");
+    Check("TC line", (unsigned long)number, got, expected);
+  }
+
+  for (uint8_t day = 0; day < 100; day++)
+    for (uint8_t hour = 0; hour < 24; hour++)
+      for (uint8_t minute = 0; minute < 60; minute++)
+        for (uint8_t second = 0; second < 60; second++)
+        {
+          FormatTimeLine(got, day, hour, minute, second);
+          PrintfTimeLine(expected, day, hour, minute, second);
+          Check("time line", ((day * 24ul + hour) * 60 + minute) * 60 + second, got, expected);
+        }
+}
+
+/*! @brief Gets the time.
+ *
+ *  @return double the time in seconds.
+ */
+static double Now(void)
+{
+  struct timespec time;
+
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+/*! @brief Builds lines of one kind many times.
+ *
+ *  @param kind 0 and 1 Q16 lines with Format and snprintf, 2 and 3 time lines with Format and snprintf.
+ *  @param count Number of lines.
+ *  @return int sum of the lengths, so the work is not optimized away.
+ */
+static int BuildLines(const int kind, const long count)
+{
+  char buffer[32];
+  int sum = 0;
+
+  for (long i = 0; i < count; i++)
+  {
+    uint32_t number = (uint32_t)(i * 2654435761u) % 0x03E80000u;
+
+    switch (kind)
+    {
+      case 0:
+        sum += FormatQ16Line(buffer, "AP: ", number, 3, 999, "xxx.xxx");
+        break;
+      case 1:
+        sum += PrintfQ16Line(buffer, "AP: ", number, 3, 999, "xxx.xxx");
+        break;
+      case 2:
+        sum += FormatTimeLine(buffer, i % 100, i % 24, i % 60, i % 59);
+        break;
+      default:
+        sum += PrintfTimeLine(buffer, i % 100, i % 24, i % 60, i % 59);
+        break;
+    }
+  }
+  return sum;
+}
+
+static int Kind;
+static volatile int Sink;
+
+/*! @brief Thread that builds lines of one kind, for the stack measurement.
+ *
+ *  @param argument Not used.
+ *  @return void* NULL.
+ */
+static void* LineThread(void* argument)
+{
+  (void)argument;
+  Sink += BuildLines(Kind, 1000);
+  return NULL;
+}
+
+/*! @brief Measures the stack a thread uses to build lines of one kind.
+ *
+ *  @param kind The kind of line, as in BuildLines.
+ *  @return size_t bytes of the thread's stack written.
+ */
+static size_t StackUsed(const int kind)
+{
+  static uint8_t stack[STACK_SIZE] __attribute__((aligned(64)));
+  pthread_attr_t attributes;
+  pthread_t thread;
+  size_t untouched = 0;
+
+  memset(stack, STACK_PAINT, sizeof(stack));
+  Kind = kind;
+  if (pthread_attr_init(&attributes) != 0
+   || pthread_attr_setstack(&attributes, stack, sizeof(stack)) != 0
+   || pthread_create(&thread, &attributes, LineThread, NULL) != 0)
+    return 0;
+  (void)pthread_join(thread, NULL);
+
+  // The stack grows down, so the bytes never written are at the bottom
+  while (untouched < sizeof(stack) && stack[untouched] == STACK_PAINT)
+    untouched++;
+  return sizeof(stack) - untouched;
+}
+
+int main(void)
+{
+  static const char* const Names[] = {"Q16 line, Format:", "Q16 line, snprintf:", "time line, Format:", "time line, snprintf:"};
+
+  TestDigits();
+  TestUnsigned();
+  TestQ16();
+  TestLines();
+
+  if (Failures)
+  {
+    printf("%lu failures\n", Failures);
+    return 1;
+  }
+
+  for (int kind = 0; kind < 4; kind++)
+  {
+    double start = Now();
+
+    Sink += BuildLines(kind, NB_TIMED);
+    printf("%-21s %6.1f ns, thread stack used %5zu bytes\n", Names[kind], (Now() - start) * 1e9 / NB_TIMED,
+           StackUsed(kind));
+  }
+
+  printf("All Format tests passed\n");
+  return 0;
+}
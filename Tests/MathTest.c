@@ -0,0 +1,306 @@
+/*! @file
+ *
+ *  @brief Host tests for the fixed-point routines in Math.h and Math.c.
+ *
+ *  Every routine is checked bit for bit against a reference model that works in 128 bits,
+ *  over edge cases and pseudo-random inputs. Build and run with "make" in this directory.
+ *
+ *  @author Zhengjie Huang
+ *  @date 2017-10-17
+ */
+
+#include "Math.h"
+
+#include <stdio.h>
+#include <inttypes.h>
+
+// Same reciprocals as meter.c, Display.c and Protocol.c
+static const TReciprocal PerHundred  = MATH_RECIPROCAL(100, 38);
+static const TReciprocal PerThousand = MATH_RECIPROCAL(1000, 41);
+static const TReciprocal PerHour     = MATH_RECIPROCAL(3600, 43);
+static const TReciprocal PerKWh      = MATH_RECIPROCAL(3600000, 53);
+
+#define NB_RANDOM 2000000
+
+static unsigned long Failures;
+static uint64_t RandomState = 0x9E3779B97F4A7C15ull;
+
+/*! @brief Gets a pseudo-random number (xorshift64).
+ *
+ *  @return uint64_t the number.
+ */
+static uint64_t Random(void)
+{
+  RandomState ^= RandomState << 13;
+  RandomState ^= RandomState >> 7;
+  RandomState ^= RandomState << 17;
+  return RandomState;
+}
+
+/*! @brief Gets a pseudo-random number with a random number of significant bits, so small values are tested too.
+ *
+ *  @return uint64_t the number.
+ */
+static uint64_t RandomBits(void)
+{
+  uint8_t bits = (uint8_t)(Random() % 65);
+
+  return (bits == 64) ? Random() : Random() & ((1ull << bits) - 1);
+}
+
+/*! @brief Records a mismatch.
+ *
+ *  @param name Routine tested.
+ *  @param input The input that failed.
+ *  @param got Value returned.
+ *  @param expected Value of the reference model.
+ */
+static void Check(const char* const name, const uint64_t input, const uint64_t got, const uint64_t expected)
+{
+  if (got == expected)
+    return;
+
+  if (Failures < 20)
+    printf("FAIL %s(0x%016" PRIx64 "): got %" PRIu64 ", expected %" PRIu64 "\n", name, input, got, expected);
+  Failures++;
+}
+
+/*! @brief Reference floor(sqrt(number)).
+ *
+ *  @param number The number.
+ *  @return uint64_t the root.
+ */
+static uint64_t RefSqrt(const uint64_t number)
+{
+  uint64_t low = 0, high = 0x100000000ull;
+
+  // Largest root whose square is not above the number, by bisection
+  while (high - low > 1)
+  {
+    uint64_t middle = (low + high) / 2;
+
+    if ((unsigned __int128)middle * middle <= number)
+      low = middle;
+    else
+      high = middle;
+  }
+  return low;
+}
+
+/*! @brief Checks Math_MulWideU against a 128-bit product.
+ */
+static void TestMulWideU(void)
+{
+  static const uint32_t edges[] = {0, 1, 2, 0xFFFF, 0x10000, 0x7FFFFFFF, 0x80000000, 0xFFFFFFFF};
+
+  for (unsigned i = 0; i < sizeof(edges) / sizeof(edges[0]); i++)
+    for (unsigned j = 0; j < sizeof(edges) / sizeof(edges[0]); j++)
+      Check("Math_MulWideU", ((uint64_t)edges[i] << 32) | edges[j], Math_MulWideU(edges[i], edges[j]),
+            (uint64_t)((unsigned __int128)edges[i] * edges[j]));
+
+  for (long n = 0; n < NB_RANDOM; n++)
+  {
+    uint64_t input = Random();
+    uint32_t a = (uint32_t)(input >> 32), b = (uint32_t)input;
+
+    Check("Math_MulWideU", input, Math_MulWideU(a, b), (uint64_t)((unsigned __int128)a * b));
+  }
+}
+
+/*! @brief Checks Math_RecipMul with one reciprocal against (number * multiplier) >> shift in 128 bits,
+ *         and the result against the true quotient within the documented bound.
+ *
+ *  @param name Name to report.
+ *  @param reciprocal The reciprocal.
+ *  @param divisor The divisor it stands for.
+ */
+static void TestRecipMul(const char* const name, const TReciprocal reciprocal, const uint64_t divisor)
+{
+  for (long n = 0; n < NB_RANDOM; n++)
+  {
+    uint64_t number;
+
+    // Edge cases first: multiples of the divisor and their neighbours, and the top of the range
+    if (n < 3000)
+      number = divisor * (uint64_t)(n / 3) + (uint64_t)(n % 3) - 1;
+    else if (n < 3010)
+      number = UINT64_MAX - (uint64_t)(n - 3000);
+    else
+      number = RandomBits();
+
+    uint64_t got = Math_RecipMul(number, reciprocal);
+    unsigned __int128 product = (unsigned __int128)number * reciprocal.multiplier;
+
+    Check(name, number, got, (uint64_t)(product >> reciprocal.shift));
+
+    // Within number / 2^(shift + 1) of the exact quotient, plus one for rounding down
+    uint64_t quotient = number / divisor;
+    uint64_t bound = (number >> (reciprocal.shift + 1)) + 1;
+    uint64_t error = (got > quotient) ? got - quotient : quotient - got;
+
+    if (error > bound)
+      Check(name, number, got, quotient);
+  }
+}
+
+/*! @brief Checks Math_ShiftRound against round half up in 128 bits.
+ */
+static void TestShiftRound(void)
+{
+  for (long n = 0; n < NB_RANDOM; n++)
+  {
+    uint8_t shift = (uint8_t)(1 + n % 62);
+    // Keep number + 2^(shift - 1) inside 64 bits
+    int64_t number = (int64_t)(Random() >> 1) - (int64_t)(n & 1 ? 0 : INT64_MAX / 2);
+    if (number > INT64_MAX - ((int64_t)1 << (shift - 1)))
+      number -= (int64_t)1 << (shift - 1);
+    if (n < 124)
+      number = ((int64_t)1 << (shift - 1)) * ((n & 1) ? -1 : 1) - (n & 2 ? 1 : 0);
+
+    __int128 expected = ((__int128)number + ((__int128)1 << (shift - 1))) >> shift;
+
+    Check("Math_ShiftRound", (uint64_t)number, (uint64_t)Math_ShiftRound(number, shift), (uint64_t)(int64_t)expected);
+  }
+}
+
+/*! @brief Checks the saturating conversions against clamps done in 64 bits.
+ */
+static void TestSaturate(void)
+{
+  static const int64_t edges[] = {0, 1, -1, 0xFFFF, 0x10000, INT32_MAX, (int64_t)INT32_MAX + 1,
+                                  INT32_MIN, (int64_t)INT32_MIN - 1, 0xFFFFFFFFll, 0x100000000ll, INT64_MAX, INT64_MIN};
+
+  for (long n = 0; n < NB_RANDOM; n++)
+  {
+    int64_t number = (n < (long)(sizeof(edges) / sizeof(edges[0]))) ? edges[n] : (int64_t)((n & 1) ? 0 - RandomBits() : RandomBits());
+    uint64_t unsignedNumber = (uint64_t)number;
+    int32_t narrow = (int32_t)Math_SatS32(number >> (n & 31));
+
+    Check("Math_SatU16", unsignedNumber, Math_SatU16(unsignedNumber), (unsignedNumber > 0xFFFF) ? 0xFFFF : unsignedNumber);
+    Check("Math_SatU32", unsignedNumber, Math_SatU32(unsignedNumber), (unsignedNumber > 0xFFFFFFFF) ? 0xFFFFFFFF : unsignedNumber);
+    Check("Math_SatS32", unsignedNumber, (uint64_t)(int64_t)Math_SatS32(number),
+          (uint64_t)((number > INT32_MAX) ? INT32_MAX : (number < INT32_MIN) ? INT32_MIN : number));
+    Check("Math_SatS16", (uint64_t)(int64_t)narrow, (uint64_t)(int64_t)Math_SatS16(narrow),
+          (uint64_t)(int64_t)((narrow > INT16_MAX) ? INT16_MAX : (narrow < INT16_MIN) ? INT16_MIN : narrow));
+  }
+}
+
+/*! @brief Checks the signed multiplies against 128-bit products.
+ *
+ *  Math_MulWide and Math_MulAcc must be exact, Math_MulQ16 rounded half up and saturated.
+ */
+static void TestMulSigned(void)
+{
+  static const int32_t edges[] = {0, 1, -1, 0x8000, -0x8000, 0x10000, -0x10000, INT32_MAX, INT32_MIN};
+  const unsigned nbEdges = sizeof(edges) / sizeof(edges[0]);
+  int64_t accumulator = 0;
+  __int128 reference = 0;
+
+  for (long n = 0; n < NB_RANDOM; n++)
+  {
+    int32_t a = (n < nbEdges * nbEdges) ? edges[n / nbEdges] : (int32_t)RandomBits();
+    int32_t b = (n < nbEdges * nbEdges) ? edges[n % nbEdges] : (int32_t)RandomBits();
+    uint64_t input = ((uint64_t)(uint32_t)a << 32) | (uint32_t)b;
+    __int128 product = (__int128)a * b;
+    __int128 rounded = (product + 32768) >> 16;
+
+    Check("Math_MulWide", input, (uint64_t)Math_MulWide(a, b), (uint64_t)(int64_t)product);
+    Check("Math_MulQ16", input, (uint64_t)(int64_t)Math_MulQ16(a, b),
+          (uint64_t)(int64_t)((rounded > INT32_MAX) ? INT32_MAX : (rounded < INT32_MIN) ? INT32_MIN : rounded));
+
+    // A running sum, started again before it could leave 64 bits
+    if (reference > ((__int128)1 << 62) || reference < -((__int128)1 << 62))
+    {
+      accumulator = 0;
+      reference = 0;
+    }
+    accumulator = Math_MulAcc(accumulator, a, b);
+    reference += product;
+    Check("Math_MulAcc", input, (uint64_t)accumulator, (uint64_t)(int64_t)reference);
+  }
+}
+
+/*! @brief Checks Math_MulQ16Wide against a 128-bit product wherever the result fits in 64 bits.
+ */
+static void TestMulQ16Wide(void)
+{
+  for (long n = 0; n < NB_RANDOM; n++)
+  {
+    uint64_t number = RandomBits();
+    uint32_t factor = (uint32_t)RandomBits();
+    unsigned __int128 expected = ((unsigned __int128)number * factor) >> 16;
+
+    if (expected >> 64)
+      continue;
+    Check("Math_MulQ16Wide", number, Math_MulQ16Wide(number, factor), (uint64_t)expected);
+  }
+}
+
+/*! @brief Checks Math_ISqrt32 exhaustively below 2^24, around every perfect square, and at random.
+ */
+static void TestISqrt32(void)
+{
+  for (uint32_t number = 0; number < (1u << 24); number++)
+    Check("Math_ISqrt32", number, Math_ISqrt32(number), RefSqrt(number));
+
+  for (uint64_t root = 1; root <= 0xFFFF; root++)
+  {
+    uint32_t square = (uint32_t)(root * root);
+
+    Check("Math_ISqrt32", square - 1, Math_ISqrt32(square - 1), root - 1);
+    Check("Math_ISqrt32", square, Math_ISqrt32(square), root);
+    Check("Math_ISqrt32", square + 1, Math_ISqrt32(square + 1), root);
+  }
+  Check("Math_ISqrt32", 0xFFFFFFFF, Math_ISqrt32(0xFFFFFFFF), 0xFFFF);
+
+  for (long n = 0; n < NB_RANDOM; n++)
+  {
+    uint32_t number = (uint32_t)Random();
+
+    Check("Math_ISqrt32", number, Math_ISqrt32(number), RefSqrt(number));
+  }
+}
+
+/*! @brief Checks Math_ISqrt64 around perfect squares and at random.
+ */
+static void TestISqrt64(void)
+{
+  Check("Math_ISqrt64", UINT64_MAX, Math_ISqrt64(UINT64_MAX), 0xFFFFFFFF);
+
+  for (long n = 0; n < NB_RANDOM; n++)
+  {
+    uint64_t root = RandomBits() & 0xFFFFFFFF;
+    uint64_t square = root * root;
+
+    Check("Math_ISqrt64", square, Math_ISqrt64(square), root);
+    if (square)
+      Check("Math_ISqrt64", square - 1, Math_ISqrt64(square - 1), root - 1);
+
+    uint64_t number = RandomBits();
+
+    Check("Math_ISqrt64", number, Math_ISqrt64(number), RefSqrt(number));
+  }
+}
+
+int main(void)
+{
+  TestMulWideU();
+  TestMulSigned();
+  TestRecipMul("Math_RecipMul/100", PerHundred, 100);
+  TestRecipMul("Math_RecipMul/1000", PerThousand, 1000);
+  TestRecipMul("Math_RecipMul/3600", PerHour, 3600);
+  TestRecipMul("Math_RecipMul/3600000", PerKWh, 3600000);
+  TestShiftRound();
+  TestSaturate();
+  TestMulQ16Wide();
+  TestISqrt32();
+  TestISqrt64();
+
+  if (Failures)
+  {
+    printf("%lu failures\n", Failures);
+    return 1;
+  }
+  printf("All Math tests passed\n");
+  return 0;
+}
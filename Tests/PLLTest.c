@@ -0,0 +1,251 @@
+/*! @file
+ *
+ *  @brief Host simulation of the PLL and the frequency measurement against a sampled sine wave.
+ *
+ *  The samples are taken the way MeterCallback takes them: each one is a running period after the
+ *  one before, and the period from PLL_NextPeriod only takes effect at the next reload of the PIT.
+ *  The sine has +/-NOISE LSB of uniform noise. It checks the lock time given in PLL.c and the
+ *  accuracy given in Frequency.c, at every sample density. Build and run with "make" in this directory.
+ *
+ *  @author Zhengjie Huang
+ *  @date 2017-10-17
+ */
+
+#include "PLL.h"
+#include "Frequency.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MODULE_CLK 25000000
+#define NS_PER_TICK (1000000000 / MODULE_CLK)
+
+#define AMPLITUDE 10000
+#define NOISE 30
+
+#define MAX_SAMPLES 128
+
+// Cycles run before a change, and after it
+#define SETTLE_CYCLES 200
+#define RUN_CYCLES 200
+
+// Lock time given in PLL.c, in cycles after a 2 Hz step
+#define MAX_LOCK_CYCLES 13
+
+// Accuracy given in Frequency.c
+#define MAX_FREQUENCY_ERROR 8     // mHz
+#define MAX_ROCOF 80              // mHz/s
+
+static const uint8_t Densities[] = {16, 32, 64, 128};
+
+static unsigned long Failures;
+static uint64_t RandomState = 0x9E3779B97F4A7C15ull;
+
+/*!
+ * @struct TSimulation
+ */
+typedef struct
+{
+  TPLL pll;
+  uint8_t nbSamples;
+  double frequency;         /*!< Frequency of the sine in Hz */
+  double phase;             /*!< Phase of the sine at the next sample in radians */
+  uint32_t time;            /*!< Time of the next sample in ticks */
+  uint32_t runningTicks;    /*!< Period the PIT is counting */
+  uint32_t loadedTicks;     /*!< Period the PIT loads at its next reload */
+} TSimulation;
+
+/*! @brief Gets a pseudo-random number (xorshift64).
+ *
+ *  @return uint64_t the number.
+ */
+static uint64_t Random(void)
+{
+  RandomState ^= RandomState << 13;
+  RandomState ^= RandomState >> 7;
+  RandomState ^= RandomState << 17;
+  return RandomState;
+}
+
+/*! @brief Starts a simulation as Meter_Init starts the PLL and the frequency measurement.
+ *
+ *  @param simulation The simulation.
+ *  @param nbSamples Samples per cycle.
+ *  @param frequency Frequency of the sine in Hz.
+ */
+static void Start(TSimulation* const simulation, const uint8_t nbSamples, const double frequency)
+{
+  const uint32_t nominalTicks = 1000000000 / (50 * nbSamples) / NS_PER_TICK;
+
+  simulation->nbSamples = nbSamples;
+  simulation->frequency = frequency;
+  simulation->phase = 0.3;
+  simulation->time = 0;
+  simulation->runningTicks = nominalTicks;
+  simulation->loadedTicks = nominalTicks;
+  Frequency_Init(MODULE_CLK);
+  PLL_Init(&simulation->pll, nbSamples, nominalTicks,
+           1000000000 / (55 * nbSamples) / NS_PER_TICK, 1000000000 / (45 * nbSamples) / NS_PER_TICK);
+}
+
+/*! @brief Samples one block and passes it to the frequency measurement and the PLL, as the meter thread does.
+ *
+ *  @param simulation The simulation.
+ */
+static void RunCycle(TSimulation* const simulation)
+{
+  int16_t voltage[MAX_SAMPLES];
+  const uint32_t blockTime = simulation->time;
+
+  for (uint8_t i = 0; i < simulation->nbSamples; i++)
+  {
+    int noise = (int)(Random() % (2 * NOISE + 1)) - NOISE;
+
+    voltage[i] = (int16_t)lround(AMPLITUDE * sin(simulation->phase)) + noise;
+
+    // The next sample is a running period later, and the period just loaded runs after that
+    uint32_t ticks = PLL_NextPeriod(&simulation->pll);
+    simulation->phase += 2 * M_PI * simulation->frequency * simulation->runningTicks / MODULE_CLK;
+    simulation->time += simulation->runningTicks;
+    simulation->runningTicks = simulation->loadedTicks;
+    simulation->loadedTicks = ticks;
+  }
+
+  Frequency_Update(voltage, simulation->nbSamples, blockTime, simulation->pll.periodQ16);
+  PLL_Update(&simulation->pll, voltage);
+}
+
+/*! @brief Records a failure.
+ *
+ *  @param what What went wrong.
+ *  @param nbSamples Samples per cycle.
+ *  @param value The value that failed.
+ */
+static void Fail(const char* const what, const uint8_t nbSamples, const double value)
+{
+  if (Failures < 20)
+    printf("FAIL %s at %u samples per cycle: %g\n", what, nbSamples, value);
+  Failures++;
+}
+
+/*! @brief Steps the frequency by 2 Hz each way from a locked 50 Hz and checks how many cycles it takes to lock again.
+ *
+ *  The lock time is counted to the end of the last cycle that was not locked.
+ */
+static void TestLockTime(void)
+{
+  static const double Steps[] = {2, -2};
+
+  printf("samples  step   lock time  frequency\n");
+  for (size_t d = 0; d < sizeof(Densities); d++)
+  {
+    for (size_t s = 0; s < sizeof(Steps) / sizeof(Steps[0]); s++)
+    {
+      TSimulation simulation;
+      int lockTime = 0;
+
+      Start(&simulation, Densities[d], 50);
+      for (int cycle = 0; cycle < SETTLE_CYCLES; cycle++)
+        RunCycle(&simulation);
+      if (!simulation.pll.locked)
+        Fail("lock at 50 Hz", Densities[d], 50);
+
+      simulation.frequency += Steps[s];
+      for (int cycle = 1; cycle <= RUN_CYCLES; cycle++)
+      {
+        RunCycle(&simulation);
+        if (!simulation.pll.locked)
+          lockTime = cycle + 1;
+      }
+
+      printf("%5u   %+.0f Hz  %3d cycles  %6.3f Hz\n", Densities[d], Steps[s], lockTime, Frequency_Get() / 1000.0);
+
+      if (lockTime > MAX_LOCK_CYCLES)
+        Fail("lock time", Densities[d], lockTime);
+    }
+  }
+}
+
+/*! @brief Checks that the loop locks from power up near the ends of the 45-55 Hz range.
+ *
+ *  Right at the ends the period is at its limit and the phase error is pulled in only by the
+ *  difference from the limit, which takes minutes.
+ */
+static void TestRange(void)
+{
+  static const double Frequencies[] = {45.5, 54.5};
+
+  for (size_t d = 0; d < sizeof(Densities); d++)
+  {
+    for (size_t f = 0; f < sizeof(Frequencies) / sizeof(Frequencies[0]); f++)
+    {
+      TSimulation simulation;
+
+      Start(&simulation, Densities[d], Frequencies[f]);
+      for (int cycle = 0; cycle < SETTLE_CYCLES + RUN_CYCLES; cycle++)
+        RunCycle(&simulation);
+
+      double measured = Frequency_Get() / 1000.0;
+
+      if (!simulation.pll.locked || fabs(measured - Frequencies[f]) > 0.01)
+        Fail("lock near the end of the range", Densities[d], measured);
+    }
+  }
+}
+
+/*! @brief Checks the measured frequency and rate of change of frequency at steady frequencies.
+ */
+static void TestFrequency(void)
+{
+  static const double Frequencies[] = {50, 49.987, 51.234, 47.5};
+
+  printf("samples  frequency   max error  max |ROCOF|\n");
+  for (size_t d = 0; d < sizeof(Densities); d++)
+  {
+    for (size_t f = 0; f < sizeof(Frequencies) / sizeof(Frequencies[0]); f++)
+    {
+      TSimulation simulation;
+      double maxError = 0, maxROCOF = 0;
+
+      Start(&simulation, Densities[d], Frequencies[f]);
+      for (int cycle = 0; cycle < SETTLE_CYCLES; cycle++)
+        RunCycle(&simulation);
+
+      for (int cycle = 0; cycle < RUN_CYCLES; cycle++)
+      {
+        RunCycle(&simulation);
+
+        double error = fabs(Frequency_Get() - Frequencies[f] * 1000);
+        double rocof = fabs((double)Frequency_GetROCOF());
+
+        if (error > maxError)
+          maxError = error;
+        if (rocof > maxROCOF)
+          maxROCOF = rocof;
+      }
+
+      printf("%5u   %9.3f Hz  %5.1f mHz  %5.1f mHz/s\n", Densities[d], Frequencies[f], maxError, maxROCOF);
+
+      if (maxError > MAX_FREQUENCY_ERROR)
+        Fail("frequency error in mHz", Densities[d], maxError);
+      if (maxROCOF > MAX_ROCOF)
+        Fail("ROCOF noise in mHz/s", Densities[d], maxROCOF);
+    }
+  }
+}
+
+int main(void)
+{
+  TestLockTime();
+  TestRange();
+  TestFrequency();
+
+  if (Failures)
+  {
+    printf("%lu failures\n", Failures);
+    return 1;
+  }
+  printf("All PLL tests passed\n");
+  return 0;
+}
@@ -0,0 +1,379 @@
+/*! @file
+ *
+ *  @brief Host tests for the packet encoding and decoding in MyPacket.c.
+ *
+ *  The UART is replaced by buffers, so what MyPacket sends can be checked byte for byte and fed
+ *  back to it, with or without bit errors. Build and run with "make" in this directory.
+ *
+ *  @author Zhengjie Huang
+ *  @date 2017-10-17
+ */
+
+#include "MyPacket.h"
+#include "UART.h"
+#include "Crc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Packets sent through the bit error test, and how far ahead a received one is looked for
+#define NB_ERROR_PACKETS 200000
+#define MATCH_WINDOW 50
+
+#define BAUD_RATE 115200
+// 8N1: a start bit, 8 data bits and a stop bit
+#define BITS_PER_BYTE 10
+
+#define TX_SIZE (NB_ERROR_PACKETS * 16)
+
+TPacket Packet;
+const uint8_t PACKET_ACK_MASK = 0x80;
+
+static unsigned long Failures;
+static uint64_t RandomState = 0x9E3779B97F4A7C15ull;
+
+static uint8_t TxBuffer[TX_SIZE];       /*!< Bytes sent by MyPacket */
+static size_t TxLength;
+static const uint8_t* RxBuffer;         /*!< Bytes MyPacket receives */
+static size_t RxLength;
+static size_t RxIndex;
+
+bool UART_Init(const uint32_t baudRate, const uint32_t moduleClk)
+{
+  (void)baudRate;
+  (void)moduleClk;
+  return true;
+}
+
+bool UART_InChar(uint8_t* const dataPtr)
+{
+  if (RxIndex >= RxLength)
+    return false;
+  *dataPtr = RxBuffer[RxIndex++];
+  return true;
+}
+
+bool UART_OutChar(const uint8_t data)
+{
+  if (TxLength >= TX_SIZE)
+    return false;
+  TxBuffer[TxLength++] = data;
+  return true;
+}
+
+bool UART_OutBlock(const uint8_t* const data, const uint16_t length)
+{
+  if (length > TX_SIZE - TxLength)
+    return false;
+  // data may be NULL when length is 0
+  if (length)
+    memcpy(&TxBuffer[TxLength], data, length);
+  TxLength += length;
+  return true;
+}
+
+/*! @brief Gets a pseudo-random number (xorshift64).
+ *
+ *  @return uint64_t the number.
+ */
+static uint64_t Random(void)
+{
+  RandomState ^= RandomState << 13;
+  RandomState ^= RandomState >> 7;
+  RandomState ^= RandomState << 17;
+  return RandomState;
+}
+
+/*! @brief Records a failure.
+ *
+ *  @param what What went wrong.
+ *  @param value A value that identifies the case.
+ */
+static void Fail(const char* const what, const unsigned long value)
+{
+  if (Failures < 20)
+    printf("FAIL %s (%lu)\n", what, value);
+  Failures++;
+}
+
+/*! @brief Starts MyPacket afresh in a mode, with nothing sent or received.
+ *
+ *  @param mode The mode.
+ */
+static void Restart(const TPacketMode mode)
+{
+  (void)MyPacket_Init(BAUD_RATE, 0);
+  MyPacket_SetMode(mode);
+  TxLength = 0;
+  RxLength = 0;
+  RxIndex = 0;
+}
+
+/*! @brief Decodes a COBS frame, independently of MyPacket.c.
+ *
+ *  @param in The frame without its 0 delimiter.
+ *  @param length Number of bytes in the frame.
+ *  @param out A pointer to the decoded bytes, at least as long as the frame.
+ *  @return long number of bytes decoded, or -1 if the frame is not valid COBS.
+ */
+static long DecodeCOBS(const uint8_t* const in, const size_t length, uint8_t* const out)
+{
+  size_t i = 0;
+  long nbOut = 0;
+
+  while (i < length)
+  {
+    uint8_t code = in[i++];
+
+    if (code == 0 || i + code - 1 > length)
+      return -1;
+    for (uint8_t k = 1; k < code; k++)
+      out[nbOut++] = in[i++];
+    if (code != 0xFF && i < length)
+      out[nbOut++] = 0;
+  }
+  return nbOut;
+}
+
+/*! @brief Checks a frame with every payload length, with random data, all zeros and no zeros.
+ *
+ *  The frame must hold no 0 but its delimiter, and decode to the header, payload and CRC-16.
+ */
+static void TestFrameEncoding(void)
+{
+  uint8_t data[255];
+  uint8_t decoded[300];
+
+  for (int pattern = 0; pattern < 3; pattern++)
+  {
+    Restart(PACKET_MODE_FRAMED);
+
+    for (unsigned length = 0; length <= 255; length++)
+    {
+      for (unsigned i = 0; i < length; i++)
+        data[i] = (pattern == 0) ? (uint8_t)Random() : (pattern == 1) ? 0 : (uint8_t)(Random() % 255 + 1);
+
+      TxLength = 0;
+      (void)MyPacket_PutFrame(0x42, data, (uint8_t)length);
+
+      if (TxLength == 0 || TxBuffer[TxLength - 1] != 0 || memchr(TxBuffer, 0, TxLength - 1))
+      {
+        Fail("frame delimiter", length);
+        continue;
+      }
+
+      long nbDecoded = DecodeCOBS(TxBuffer, TxLength - 1, decoded);
+
+      if (nbDecoded != (long)length + PACKET_FRAME_OVERHEAD
+       || decoded[0] != 0x42
+       || decoded[1] != (uint8_t)length
+       || decoded[2] != length
+       || memcmp(&decoded[3], data, length) != 0
+       || Crc_16(CRC_16_INIT, decoded, nbDecoded - 2) != (decoded[nbDecoded - 2] | decoded[nbDecoded - 1] << 8))
+        Fail("frame contents", length);
+    }
+  }
+}
+
+/*! @brief Checks the frame sent in fixed mode: a packet with the length, the data and its CRC-16.
+ */
+static void TestFixedFrame(void)
+{
+  uint8_t data[255];
+
+  Restart(PACKET_MODE_FIXED);
+
+  for (unsigned length = 0; length <= 255; length++)
+  {
+    for (unsigned i = 0; i < length; i++)
+      data[i] = (uint8_t)Random();
+
+    TxLength = 0;
+    (void)MyPacket_PutFrame(0x26, data, (uint8_t)length);
+
+    uint16_t crc = Crc_16(CRC_16_INIT, data, length);
+
+    if (TxLength != PACKET_NB_BYTES + length + 2
+     || TxBuffer[0] != 0x26 || TxBuffer[1] != length || TxBuffer[2] != 0 || TxBuffer[3] != 0
+     || TxBuffer[4] != (0x26 ^ length)
+     || memcmp(&TxBuffer[PACKET_NB_BYTES], data, length) != 0
+     || TxBuffer[PACKET_NB_BYTES + length] != (uint8_t)crc
+     || TxBuffer[PACKET_NB_BYTES + length + 1] != (uint8_t)(crc >> 8))
+      Fail("fixed frame", length);
+  }
+}
+
+/*! @brief Checks that every split of the payload between head and data sends the same bytes as MyPacket_PutFrame.
+ */
+static void TestFrameHead(void)
+{
+  static uint8_t expected[400];
+  uint8_t data[255];
+
+  for (int mode = PACKET_MODE_FIXED; mode <= PACKET_MODE_FRAMED; mode++)
+  {
+    for (unsigned length = 0; length <= 255; length++)
+    {
+      for (unsigned i = 0; i < length; i++)
+        data[i] = (Random() & 3) ? (uint8_t)Random() : 0;
+
+      // A fresh start each time, so the frames carry the same sequence number
+      Restart((TPacketMode)mode);
+      (void)MyPacket_PutFrame(0x29, data, (uint8_t)length);
+      size_t expectedLength = TxLength;
+      memcpy(expected, TxBuffer, expectedLength);
+
+      for (unsigned head = 0; head <= length; head++)
+      {
+        Restart((TPacketMode)mode);
+        (void)MyPacket_PutFrameHead(0x29, data, (uint8_t)head, &data[head], (uint8_t)(length - head));
+
+        if (TxLength != expectedLength || memcmp(TxBuffer, expected, expectedLength) != 0)
+          Fail((mode == PACKET_MODE_FRAMED) ? "framed head split" : "fixed head split", length * 256 + head);
+      }
+    }
+  }
+}
+
+/*! @brief Sends random packets and checks that they all come back in order when received.
+ */
+static void TestReceive(void)
+{
+  static uint8_t sent[20000][4];
+  static uint8_t received[TX_SIZE];
+
+  for (int mode = PACKET_MODE_FIXED; mode <= PACKET_MODE_FRAMED; mode++)
+  {
+    Restart((TPacketMode)mode);
+    for (unsigned i = 0; i < 20000; i++)
+    {
+      for (int k = 0; k < 4; k++)
+        sent[i][k] = (uint8_t)Random();
+      (void)MyPacket_Put(sent[i][0], sent[i][1], sent[i][2], sent[i][3]);
+    }
+
+    size_t length = TxLength;
+    memcpy(received, TxBuffer, length);
+    Restart((TPacketMode)mode);
+    RxBuffer = received;
+    RxLength = length;
+
+    unsigned nbReceived = 0;
+
+    while (RxIndex < RxLength)
+    {
+      if (!MyPacket_Get())
+        continue;
+      if (nbReceived >= 20000
+       || Packet_Command != sent[nbReceived][0]
+       || Packet_Parameter1 != sent[nbReceived][1]
+       || Packet_Parameter2 != sent[nbReceived][2]
+       || Packet_Parameter3 != sent[nbReceived][3])
+        Fail((mode == PACKET_MODE_FRAMED) ? "framed receive" : "fixed receive", nbReceived);
+      nbReceived++;
+    }
+
+    if (nbReceived != 20000)
+      Fail("packets received", nbReceived);
+  }
+}
+
+/*! @brief Sends random packets through a link with random bit errors in both modes, and prints
+ *         how many are delivered, how many wrong packets are accepted and the goodput.
+ *
+ *  A packet received counts as delivered if it matches one of the next packets sent, so a lost
+ *  packet does not make the ones after it count as wrong. Framed mode must accept no wrong packet.
+ */
+static void TestBitErrors(void)
+{
+  static const double BitErrorRates[] = {0, 1e-4, 1e-3, 1e-2};
+  static uint8_t sent[NB_ERROR_PACKETS][4];
+  static uint8_t received[TX_SIZE];
+
+  printf("BER     mode    delivered  false accepts  goodput\n");
+
+  for (int mode = PACKET_MODE_FIXED; mode <= PACKET_MODE_FRAMED; mode++)
+  {
+    for (size_t rate = 0; rate < sizeof(BitErrorRates) / sizeof(BitErrorRates[0]); rate++)
+    {
+      const uint64_t threshold = (uint64_t)(BitErrorRates[rate] * 18446744073709551616.0);
+
+      Restart((TPacketMode)mode);
+      for (unsigned i = 0; i < NB_ERROR_PACKETS; i++)
+      {
+        for (int k = 0; k < 4; k++)
+          sent[i][k] = (uint8_t)Random();
+        (void)MyPacket_Put(sent[i][0], sent[i][1], sent[i][2], sent[i][3]);
+      }
+
+      size_t length = TxLength;
+      memcpy(received, TxBuffer, length);
+      if (threshold)
+      {
+        for (size_t bit = 0; bit < length * 8; bit++)
+        {
+          if (Random() < threshold)
+            received[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+        }
+      }
+
+      Restart((TPacketMode)mode);
+      RxBuffer = received;
+      RxLength = length;
+
+      unsigned delivered = 0, falseAccepts = 0, next = 0;
+
+      while (RxIndex < RxLength)
+      {
+        if (!MyPacket_Get())
+          continue;
+
+        unsigned i;
+
+        for (i = next; i < NB_ERROR_PACKETS && i < next + MATCH_WINDOW; i++)
+        {
+          if (Packet_Command == sent[i][0] && Packet_Parameter1 == sent[i][1]
+           && Packet_Parameter2 == sent[i][2] && Packet_Parameter3 == sent[i][3])
+            break;
+        }
+
+        if (i < NB_ERROR_PACKETS && i < next + MATCH_WINDOW)
+        {
+          delivered++;
+          next = i + 1;
+        }
+        else
+          falseAccepts++;
+      }
+
+      double seconds = (double)length * BITS_PER_BYTE / BAUD_RATE;
+
+      printf("%-7.0e %-7s %8.1f%%  %13u  %5.0f packets/s\n", BitErrorRates[rate],
+             (mode == PACKET_MODE_FRAMED) ? "framed" : "fixed",
+             100.0 * delivered / NB_ERROR_PACKETS, falseAccepts, delivered / seconds);
+
+      if (threshold == 0 && (delivered != NB_ERROR_PACKETS || falseAccepts != 0))
+        Fail("error free link", delivered);
+      if (mode == PACKET_MODE_FRAMED && falseAccepts != 0)
+        Fail("framed false accepts", falseAccepts);
+    }
+  }
+}
+
+int main(void)
+{
+  TestFrameEncoding();
+  TestFixedFrame();
+  TestFrameHead();
+  TestReceive();
+  TestBitErrors();
+
+  if (Failures)
+  {
+    printf("%lu failures\n", Failures);
+    return 1;
+  }
+  printf("All MyPacket tests passed\n");
+  return 0;
+}
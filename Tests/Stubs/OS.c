@@ -0,0 +1,82 @@
+/*! @file
+ *
+ *  @brief Host stand-in for the RTOS, so modules that use it can be tested on the host.
+ *
+ *  @author Zhengjie Huang
+ *  @date 2017-10-17
+ */
+
+#include "OS.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <errno.h>
+
+volatile unsigned long OS_SemaphoreCalls;
+
+typedef struct
+{
+  void (*thread)(void* pd);
+  void* pData;
+} TThreadStart;
+
+/*! @brief Runs an OS thread on a POSIX thread.
+ *
+ *  @param argument A TThreadStart, freed here.
+ *  @return void* NULL.
+ */
+static void* RunThread(void* argument)
+{
+  TThreadStart start = *(TThreadStart*)argument;
+
+  free(argument);
+  start.thread(start.pData);
+  return NULL;
+}
+
+OS_ECB* OS_SemaphoreCreate(const uint32_t value)
+{
+  OS_ECB* semaphore = malloc(sizeof(OS_ECB));
+
+  if (semaphore && sem_init(semaphore, 0, value) != 0)
+  {
+    free(semaphore);
+    return NULL;
+  }
+  return semaphore;
+}
+
+OS_ERROR OS_SemaphoreSignal(OS_ECB* const pEvent)
+{
+  __atomic_add_fetch(&OS_SemaphoreCalls, 1, __ATOMIC_RELAXED);
+  return (sem_post(pEvent) == 0) ? OS_NO_ERROR : OS_SEMAPHORE_OVERFLOW;
+}
+
+OS_ERROR OS_SemaphoreWait(OS_ECB* const pEvent, const uint32_t timeout)
+{
+  (void)timeout;
+  __atomic_add_fetch(&OS_SemaphoreCalls, 1, __ATOMIC_RELAXED);
+  while (sem_wait(pEvent) != 0 && errno == EINTR)
+    ;
+  return OS_NO_ERROR;
+}
+
+OS_ERROR OS_ThreadCreate(void (*thread)(void* pd), void* pData, void* pStack, const uint8_t priority)
+{
+  TThreadStart* start = malloc(sizeof(TThreadStart));
+  pthread_t id;
+
+  (void)pStack;
+  (void)priority;
+  if (!start)
+    return OS_NO_MORE_TCBS;
+  start->thread = thread;
+  start->pData = pData;
+  if (pthread_create(&id, NULL, RunThread, start) != 0)
+  {
+    free(start);
+    return OS_NO_MORE_TCBS;
+  }
+  (void)pthread_detach(id);
+  return OS_NO_ERROR;
+}
@@ -0,0 +1,78 @@
+/*! @file
+ *
+ *  @brief Host stand-in for the RTOS, so modules that use it can be tested on the host.
+ *
+ *  Placed ahead of Library/OS.h on the include path. Semaphores are POSIX semaphores, and every
+ *  wait or signal is counted so the tests can report the kernel calls a module makes. Threads are
+ *  POSIX threads, so priorities are ignored.
+ *  Disabling interrupts does nothing, so a module that relies on it may only be used from one thread.
+ *
+ *  @author Zhengjie Huang
+ *  @date 2017-10-17
+ */
+
+#ifndef OS_H
+#define OS_H
+
+// Standard types
+#include <stdint.h>
+#include <stdbool.h>
+#include <semaphore.h>
+
+#define OS_THREAD_STACK(x, y) static uint32_t x[y] __attribute__ ((aligned(0x08)))
+
+// Same codes as Library/OS.h
+typedef enum
+{
+  OS_NO_ERROR,
+  OS_TIMEOUT,
+  OS_PRIORITY_EXISTS,
+  OS_PRIORITY_INVALID,
+  OS_NO_MORE_TCBS,
+  OS_THREAD_DELETE_ERROR,
+  OS_THREAD_DELETE_IDLE,
+  OS_THREAD_DELETE_ISR,
+  OS_SEMAPHORE_OVERFLOW
+} OS_ERROR;
+
+typedef sem_t OS_ECB;
+
+// Number of calls to OS_SemaphoreWait and OS_SemaphoreSignal so far
+extern volatile unsigned long OS_SemaphoreCalls;
+
+/*! @brief Creates a semaphore.
+ *
+ *  @param value The initial count.
+ *  @return OS_ECB* the semaphore, or NULL if there is no memory left.
+ */
+OS_ECB* OS_SemaphoreCreate(const uint32_t value);
+
+/*! @brief Signals a semaphore.
+ *
+ *  @param pEvent The semaphore.
+ *  @return OS_ERROR - OS_NO_ERROR, or OS_SEMAPHORE_OVERFLOW if the count is at its maximum.
+ */
+OS_ERROR OS_SemaphoreSignal(OS_ECB* const pEvent);
+
+/*! @brief Waits on a semaphore.
+ *
+ *  @param pEvent The semaphore.
+ *  @param timeout Ignored, the wait has no timeout.
+ *  @return OS_ERROR - OS_NO_ERROR.
+ */
+OS_ERROR OS_SemaphoreWait(OS_ECB* const pEvent, const uint32_t timeout);
+
+/*! @brief Creates a thread and starts it.
+ *
+ *  @param thread The thread's code.
+ *  @param pData Passed to the thread.
+ *  @param pStack Ignored, the thread gets a stack of its own.
+ *  @param priority Ignored.
+ *  @return OS_ERROR - OS_NO_ERROR, or OS_NO_MORE_TCBS if the thread could not be created.
+ */
+OS_ERROR OS_ThreadCreate(void (*thread)(void* pd), void* pData, void* pStack, const uint8_t priority);
+
+#define OS_DisableInterrupts()
+#define OS_EnableInterrupts()
+
+#endif
@@ -0,0 +1,408 @@
+/*! @file
+ *
+ *  @brief Host benchmark of the telemetry push, from the end of a cycle to the last byte on the wire.
+ *
+ *  Protocol.c, Command.c, MyPacket.c and FIFO.c run on POSIX threads. The meter thread is replaced
+ *  by a model that ends a cycle at a set rate and signals the telemetry semaphore as meter.c does.
+ *  The UART is replaced by a thread that takes bytes from the transmit FIFO at 115200 baud 8N1, so
+ *  the FIFO fills and empties as it would behind the transmit DMA. The subscription is sent as a
+ *  packet to the receive FIFO. Every record is checked, and its latency is measured from the end of
+ *  its cycle to the end of its last byte on the wire. Thread priorities are not modelled.
+ *  Build and run with "make" in this directory.
+ *
+ *  @author Zhengjie Huang
+ *  @date 2017-10-17
+ */
+
+#include "MyPacket.h"
+#include "Protocol.h"
+#include "Command.h"
+#include "UART.h"
+#include "meter.h"
+#include "Bench.h"
+#include "MyRTC.h"
+#include "DAC.h"
+#include "Crc.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CMD_SNAPSHOT  0x26
+#define CMD_SUBSCRIBE 0x27
+
+#define BAUD_RATE 115200
+// 8N1: a start bit, 8 data bits and a stop bit
+#define BITS_PER_BYTE 10
+#define BYTE_TIME (1.0 * BITS_PER_BYTE / BAUD_RATE)
+
+// A snapshot record in fixed mode: the packet, 22 bytes of snapshot and the CRC-16
+#define RECORD_SIZE (PACKET_NB_BYTES + 22 + 2)
+
+// Cycles whose end times are kept, more than can be in flight
+#define NB_DUE 4096
+
+#define SETTLE_TIME 0.5
+#define RUN_TIME 2.0
+
+TPacket Packet;
+const uint8_t PACKET_ACK_MASK = 0x80;
+
+static unsigned long Failures;
+
+static TFIFO RxFIFO;
+static TFIFO TxFIFO;
+
+static pthread_mutex_t MeterLock = PTHREAD_MUTEX_INITIALIZER;
+static volatile double CycleTime;       /*!< Seconds between the ends of cycles */
+static uint32_t Cycle;                  /*!< Number of the last cycle ended */
+static double DueTime[NB_DUE];          /*!< When each cycle ended */
+static uint16_t TelemetryPeriod;
+static uint16_t TelemetryCountdown;
+static OS_ECB* TelemetrySemaphore;
+
+/*!
+ * @struct TStats
+ */
+typedef struct
+{
+  unsigned long cycles;     /*!< Cycles ended */
+  unsigned long records;    /*!< Records received */
+  unsigned long acks;       /*!< Subscription replies received */
+  double latencySum;        /*!< Sum of the latencies of the records, in seconds */
+  double latencyMax;        /*!< Longest latency */
+} TStats;
+
+static pthread_mutex_t StatsLock = PTHREAD_MUTEX_INITIALIZER;
+static TStats Stats;
+
+/*! @brief Records a failure.
+ *
+ *  @param what What went wrong.
+ *  @param value A value that identifies the case.
+ */
+static void Fail(const char* const what, const unsigned long value)
+{
+  pthread_mutex_lock(&StatsLock);
+  if (Failures < 20)
+    printf("FAIL %s (%lu)\n", what, value);
+  Failures++;
+  pthread_mutex_unlock(&StatsLock);
+}
+
+/*! @brief Gets the time.
+ *
+ *  @return double the time in seconds.
+ */
+static double Now(void)
+{
+  struct timespec time;
+
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+/*! @brief Sleeps until a time.
+ *
+ *  @param time The time in seconds, as returned by Now.
+ */
+static void SleepUntil(const double time)
+{
+  struct timespec until;
+
+  until.tv_sec = (time_t)time;
+  until.tv_nsec = (long)((time - until.tv_sec) * 1e9);
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) != 0)
+    ;
+}
+
+// The modules Protocol.c and Command.c use, which do nothing on the host
+
+uint32_t Bench_Start(void)
+{
+  return 0;
+}
+
+void Bench_Record(TBench* const bench, const uint32_t start)
+{
+  (void)bench;
+  (void)start;
+}
+
+uint32_t Bench_Read(const TBench* const bench, const TBenchField field)
+{
+  (void)bench;
+  (void)field;
+  return 0;
+}
+
+bool MyRTC_Init(void (*userFunction)(void*), void* userArguments)
+{
+  (void)userFunction;
+  (void)userArguments;
+  return true;
+}
+
+void DAC_Start()
+{
+}
+
+void DAC_Stop()
+{
+}
+
+uint8_t DAC_GetMode()
+{
+  return 0;
+}
+
+// The UART, with the transmit side drained by WireThread
+
+bool UART_Init(const uint32_t baudRate, const uint32_t moduleClk)
+{
+  (void)baudRate;
+  (void)moduleClk;
+  FIFO_Init(&RxFIFO);
+  FIFO_Init(&TxFIFO);
+  return true;
+}
+
+bool UART_InChar(uint8_t* const dataPtr)
+{
+  return FIFO_Get(&RxFIFO, dataPtr);
+}
+
+bool UART_OutChar(const uint8_t data)
+{
+  return FIFO_Put(&TxFIFO, data);
+}
+
+bool UART_OutBlock(const uint8_t* const data, const uint16_t length)
+{
+  uint16_t sent = 0;
+
+  while (sent < length)
+    sent += FIFO_PutBlock(&TxFIFO, &data[sent], length - sent);
+  return true;
+}
+
+// The meter thread's side of the telemetry, as in meter.c
+
+void Meter_GetSnapshot(TMeterSnapshot* const snapshot)
+{
+  pthread_mutex_lock(&MeterLock);
+  snapshot->cycle        = Cycle;
+  snapshot->voltageRMS   = 230 << 8;
+  snapshot->currentRMS   = (uint16_t)(Cycle << 4);
+  snapshot->averagePower = 0x00020000 + Cycle;
+  snapshot->powerFactor  = 0xF0;
+  snapshot->frequency    = 50000 + Cycle % 100;
+  snapshot->energy       = (uint64_t)Cycle << 36;
+  snapshot->cost         = (uint64_t)Cycle << 34;
+  pthread_mutex_unlock(&MeterLock);
+}
+
+bool Meter_SetTelemetry(const uint16_t period, OS_ECB* const semaphore)
+{
+  if (period > METER_TELEMETRY_MAX_PERIOD)
+    return false;
+
+  pthread_mutex_lock(&MeterLock);
+  TelemetrySemaphore = semaphore;
+  TelemetryCountdown = period;
+  TelemetryPeriod    = period;
+  pthread_mutex_unlock(&MeterLock);
+  return true;
+}
+
+/*! @brief Ends a cycle every CycleTime seconds and signals when a telemetry record is due.
+ *
+ *  @param argument Not used.
+ *  @return void* NULL.
+ */
+static void* MeterThread(void* argument)
+{
+  double next = Now();
+
+  (void)argument;
+  for (;;)
+  {
+    next += CycleTime;
+    SleepUntil(next);
+
+    pthread_mutex_lock(&MeterLock);
+    Cycle++;
+    DueTime[Cycle % NB_DUE] = Now();
+    bool due = TelemetryPeriod && --TelemetryCountdown == 0;
+    if (due)
+      TelemetryCountdown = TelemetryPeriod;
+    pthread_mutex_unlock(&MeterLock);
+
+    pthread_mutex_lock(&StatsLock);
+    Stats.cycles++;
+    pthread_mutex_unlock(&StatsLock);
+
+    if (due)
+      (void)OS_SemaphoreSignal(TelemetrySemaphore);
+  }
+  return NULL;
+}
+
+/*! @brief Checks a packet or record that has been received in full.
+ *
+ *  @param bytes The bytes received.
+ *  @param length Number of bytes.
+ *  @param endTime When its last byte left the wire.
+ */
+static void Received(const uint8_t* const bytes, const uint16_t length, const double endTime)
+{
+  static uint32_t lastCycle;
+
+  if (bytes[0] == CMD_SUBSCRIBE)
+  {
+    pthread_mutex_lock(&StatsLock);
+    Stats.acks++;
+    pthread_mutex_unlock(&StatsLock);
+    return;
+  }
+
+  uint16_t crc = Crc_16(CRC_16_INIT, &bytes[PACKET_NB_BYTES], length - PACKET_NB_BYTES - 2);
+
+  if (bytes[0] != CMD_SNAPSHOT || length != RECORD_SIZE
+   || (uint8_t)crc != bytes[length - 2] || (uint8_t)(crc >> 8) != bytes[length - 1])
+  {
+    Fail("record", bytes[0]);
+    return;
+  }
+
+  uint32_t cycle = bytes[5] | (uint32_t)bytes[6] << 8 | (uint32_t)bytes[7] << 16 | (uint32_t)bytes[8] << 24;
+
+  // Only newer cycles are sent, the ones missed while the link was busy are skipped
+  if (cycle <= lastCycle)
+    Fail("cycle sent again", cycle);
+  lastCycle = cycle;
+
+  pthread_mutex_lock(&MeterLock);
+  double latency = endTime - DueTime[cycle % NB_DUE];
+  pthread_mutex_unlock(&MeterLock);
+
+  pthread_mutex_lock(&StatsLock);
+  Stats.records++;
+  Stats.latencySum += latency;
+  if (latency > Stats.latencyMax)
+    Stats.latencyMax = latency;
+  pthread_mutex_unlock(&StatsLock);
+}
+
+/*! @brief Sends the bytes in the transmit FIFO at the baud rate and splits them into packets and records.
+ *
+ *  @param argument Not used.
+ *  @return void* NULL.
+ */
+static void* WireThread(void* argument)
+{
+  uint8_t bytes[RECORD_SIZE];
+  uint16_t length = 0;
+  double wireFree = 0;
+
+  (void)argument;
+  for (;;)
+  {
+    // A byte waiting goes straight after the one before, otherwise the line was idle until now
+    if (!FIFO_TryGet(&TxFIFO, &bytes[length]))
+    {
+      (void)FIFO_Get(&TxFIFO, &bytes[length]);
+      double now = Now();
+      if (wireFree < now)
+        wireFree = now;
+    }
+    wireFree += BYTE_TIME;
+    SleepUntil(wireFree);
+    length++;
+
+    // The packet tells whether a block of data and its CRC follow
+    uint16_t expected = (bytes[0] == CMD_SNAPSHOT && length >= PACKET_NB_BYTES)
+                      ? PACKET_NB_BYTES + bytes[1] + 2 : PACKET_NB_BYTES;
+    if (expected > RECORD_SIZE)
+    {
+      Fail("packet", bytes[0]);
+      length = 0;
+    }
+    else if (length == expected)
+    {
+      Received(bytes, length, wireFree);
+      length = 0;
+    }
+  }
+  return NULL;
+}
+
+/*! @brief Runs the meter at a cycle rate for a while and prints the records sent and their latency.
+ *
+ *  @param name Name of the run.
+ *  @param cycleRate Cycles per second.
+ *  @param minRecordRate Fewest records per second that passes.
+ */
+static void Run(const char* const name, const double cycleRate, const double minRecordRate)
+{
+  CycleTime = 1.0 / cycleRate;
+  SleepUntil(Now() + SETTLE_TIME);
+
+  pthread_mutex_lock(&StatsLock);
+  unsigned long acks = Stats.acks;
+  memset(&Stats, 0, sizeof(Stats));
+  Stats.acks = acks;
+  double start = Now();
+  pthread_mutex_unlock(&StatsLock);
+
+  SleepUntil(start + RUN_TIME);
+
+  pthread_mutex_lock(&StatsLock);
+  TStats stats = Stats;
+  double seconds = Now() - start;
+  pthread_mutex_unlock(&StatsLock);
+
+  double recordRate = stats.records / seconds;
+
+  printf("%-18s %6.0f cycles/s  %6.1f records/s (%5.1f%% of the link)  latency mean %5.2f ms, max %5.2f ms\n",
+         name, stats.cycles / seconds, recordRate, 100.0 * recordRate * RECORD_SIZE * BYTE_TIME,
+         stats.records ? stats.latencySum / stats.records * 1e3 : 0, stats.latencyMax * 1e3);
+
+  if (recordRate < minRecordRate)
+    Fail("records per second", (unsigned long)recordRate);
+}
+
+int main(void)
+{
+  static const uint8_t Subscribe[PACKET_NB_BYTES] = {CMD_SUBSCRIBE, 1, 0, 0, CMD_SUBSCRIBE ^ 1};
+  const double linkRate = 1.0 / (RECORD_SIZE * BYTE_TIME);
+  pthread_t wire, meter;
+
+  CycleTime = 1.0 / 50;
+  if (!Command_Init() || !MyPacket_Init(BAUD_RATE, 0))
+    return 1;
+  Protocol_Init();
+  if (pthread_create(&wire, NULL, WireThread, NULL) != 0 || pthread_create(&meter, NULL, MeterThread, NULL) != 0)
+    return 1;
+
+  // Subscribe to a record every cycle, as a client would
+  for (uint8_t i = 0; i < PACKET_NB_BYTES; i++)
+    (void)FIFO_Put(&RxFIFO, Subscribe[i]);
+
+  printf("%u byte records, at most %.1f records/s at %u baud\n", RECORD_SIZE, linkRate, BAUD_RATE);
+  Run("50 Hz, period 1:", 50, 50 * 0.95);
+  Run("1000 cycles/s:", 1000, linkRate * 0.9);
+
+  if (Stats.acks != 1)
+    Fail("subscription replies", Stats.acks);
+
+  if (Failures)
+  {
+    printf("%lu failures\n", Failures);
+    return 1;
+  }
+  printf("All telemetry tests passed\n");
+  return 0;
+}